@@ -21,12 +21,235 @@
 // SOFTWARE.
 
 #include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
 
 #include "annotation.h"
 
 static constexpr float pi = 3.14159265358979323846;
 
-annotation::annotation(const char *str) {
+namespace {
+    /**
+     * table read without locking: entries never move once added - additions are serialized by the caller, and an
+     * entry is only read by threads that received its index after it was added
+     */
+    template<typename T>
+    class append_only_table {
+        public:
+            append_only_table(): _size(0) {
+                for (auto &c: _chunks) c.store(nullptr, std::memory_order_relaxed);
+            }
+            ~append_only_table() {
+                for (auto &c: _chunks) delete[] c.load(std::memory_order_relaxed);
+            }
+            const T &operator[](size_t idx) const {
+                int k = _chunk(idx);
+                return _chunks[k].load(std::memory_order_acquire)[idx - _chunk_start(k)];
+            }
+            void push_back(const T &value) {
+                int k = _chunk(_size);
+                T *chunk = _chunks[k].load(std::memory_order_relaxed);
+                if (!chunk) {
+                    chunk = new T[_chunk_start(k+1) - _chunk_start(k)];
+                    _chunks[k].store(chunk, std::memory_order_release);
+                }
+                chunk[_size - _chunk_start(k)] = value;
+                _size++;
+            }
+        private:
+            /* chunk k holds the entries [base*(2^k-1), base*(2^(k+1)-1)), enough chunks for any 32-bit index */
+            static constexpr size_t base = 256;
+            static constexpr int chunks = 25;
+            static size_t _chunk_start(int k) { return base * ((size_t(1) << k) - 1); }
+            static int _chunk(size_t idx) {
+                int k = 0;
+                for (size_t q = idx / base + 1; q > 1; q >>= 1) k++;
+                return k;
+            }
+            std::atomic<T*> _chunks[chunks];
+            size_t _size;
+    };
+
+    /* order of an interned string: its first 8 characters as a big-endian integer, and the string itself for the
+     * ties */
+    struct order_key {
+        uint64_t prefix;
+        const std::string *str;
+    };
+
+    uint64_t order_prefix(const std::string &s) {
+        uint64_t prefix = 0;
+        for (size_t i = 0; i < 8; i++)
+            prefix = (prefix << 8) | (i < s.size() ? (unsigned char)s[i] : 0);
+        return prefix;
+    }
+
+    bool order_less(const order_key &a, const order_key &b) {
+        if (a.prefix != b.prefix) return a.prefix < b.prefix;
+        return *a.str < *b.str;
+    }
+
+    struct tag_table {
+        tag_table() { intern("P"); }
+        std::mutex lock;
+        /* deque does not move its elements, references to names remain valid when the table grows */
+        std::deque<std::string> names;
+        std::unordered_map<std::string, annot_tag> index;
+        /* name and name order of each tag, read without the lock */
+        append_only_table<order_key> order;
+
+        annot_tag intern(const std::string &name) {
+            auto it = index.find(name);
+            if (it != index.end()) return it->second;
+            auto tag = annot_tag(names.size());
+            names.push_back(name);
+            order.push_back(order_key{order_prefix(name), &names.back()});
+            index.emplace(name, tag);
+            return tag;
+        }
+    };
+
+    tag_table &tags() {
+        static tag_table table;
+        return table;
+    }
+}
+
+annot_tag annotation::intern_tag(const std::string &name) {
+    if (name == "P") return ANNOTATION_TAG_P;
+    auto &t = tags();
+    std::lock_guard<std::mutex> guard(t.lock);
+    return t.intern(name);
+}
+
+long annotation::find_tag(const std::string &name) {
+    if (name == "P") return ANNOTATION_TAG_P;
+    auto &t = tags();
+    std::lock_guard<std::mutex> guard(t.lock);
+    auto it = t.index.find(name);
+    return it == t.index.end() ? -1 : long(it->second);
+}
+
+const std::string &annotation::tag_name(annot_tag tag) {
+    return *tags().order[tag].str;
+}
+
+annotation::annotation(const annotation &b): _size(b._size), _capacity(ANNOTATION_INLINE_TAGS) {
+    if (_size > ANNOTATION_INLINE_TAGS) {
+        _heap.reset(new annotation_entry[_size]);
+        _capacity = _size;
+    }
+    std::copy(b._data(), b._data()+_size, _data());
+}
+
+annotation::annotation(annotation &&b) noexcept: _size(b._size), _capacity(b._capacity), _heap(std::move(b._heap)) {
+    if (!_heap)
+        std::copy(b._inline, b._inline+_size, _inline);
+    b._size = 0;
+    b._capacity = ANNOTATION_INLINE_TAGS;
+}
+
+annotation &annotation::operator=(const annotation &b) {
+    if (&b == this) return *this;
+    if (b._size > _capacity) {
+        _heap.reset(new annotation_entry[b._size]);
+        _capacity = b._size;
+    }
+    _size = b._size;
+    std::copy(b._data(), b._data()+_size, _data());
+    return *this;
+}
+
+annotation &annotation::operator=(annotation &&b) noexcept {
+    if (&b == this) return *this;
+    _size = b._size;
+    _capacity = b._capacity;
+    _heap = std::move(b._heap);
+    if (!_heap)
+        std::copy(b._inline, b._inline+_size, _inline);
+    b._size = 0;
+    b._capacity = ANNOTATION_INLINE_TAGS;
+    return *this;
+}
+
+annotation_entry &annotation::_insert(annot_tag tag, const std::complex<float> &value) {
+    if (_size == _capacity) {
+        int capacity = 2 * _capacity;
+        std::unique_ptr<annotation_entry[]> heap(new annotation_entry[capacity]);
+        std::copy(_data(), _data()+_size, heap.get());
+        _heap = std::move(heap);
+        _capacity = capacity;
+    }
+    annotation_entry *d = _data();
+    auto &t = tags();
+    const order_key &key = t.order[tag];
+    int pos = _size;
+    while (pos > 0 && order_less(key, t.order[d[pos-1].tag])) {
+        d[pos] = d[pos-1];
+        pos--;
+    }
+    d[pos].tag = tag;
+    d[pos].value = value;
+    _size++;
+    return d[pos];
+}
+
+void annotation::set(annot_tag tag, const std::complex<float> &value) {
+    annotation_entry *d = _data();
+    for (int i = 0; i < _size; i++)
+        if (d[i].tag == tag) {
+            d[i].value = value;
+            return;
+        }
+    _insert(tag, value);
+}
+
+int annotation::_find_name(const std::string &name) const {
+    /* compare the names of the few tags of the annotation, without looking up the tag table */
+    auto &t = tags();
+    uint64_t prefix = order_prefix(name);
+    const annotation_entry *d = _data();
+    for (int i = 0; i < _size; i++) {
+        const order_key &key = t.order[d[i].tag];
+        if (key.prefix == prefix && *key.str == name) return i;
+    }
+    return -1;
+}
+
+annotation::const_iterator annotation::find(const std::string &name) const {
+    int i = _find_name(name);
+    return i < 0 ? end() : const_iterator(_data()+i);
+}
+
+const std::complex<float> &annotation::at(const std::string &name) const {
+    auto it = find(name);
+    if (it == end())
+        throw std::out_of_range("unknown annotation tag");
+    return it.entry().value;
+}
+
+std::complex<float> &annotation::operator[](const std::string &name) {
+    int i = _find_name(name);
+    if (i >= 0)
+        return _data()[i].value;
+    return _insert(intern_tag(name), std::complex<float>()).value;
+}
+
+bool annotation::operator==(const annotation &b) const {
+    /* entries of both annotations are in the same order */
+    if (b._size != _size) return false;
+    const annotation_entry *d = _data();
+    const annotation_entry *bd = b._data();
+    for (int i = 0; i < _size; i++)
+        if (d[i].tag != bd[i].tag || d[i].value != bd[i].value) return false;
+    return true;
+}
+
+annotation::annotation(const char *str): annotation() {
     if (!*str) {
         return;
     }
@@ -112,19 +335,19 @@ annotation::annotation(const char *str) {
         }
         if (pos == -1 || vstr[pos])
             throw std::invalid_argument("invalid annotation (cannot parse value)");
-        if (this->find(_name) != this->end())
+        annot_tag tag = intern_tag(_name);
+        if (_find(tag))
             throw std::invalid_argument("invalid annotation (duplicate tag)");
-        (*this)[_name] = std::complex<float>(real, imaginary);
+        _insert(tag, std::complex<float>(real, imaginary));
         str += j;
         if (*str == ',') str += 1;
     } while(*str);
 }
 
-std::string annotation::str_value(const std::string &tag) const {
+static std::string value_str(annot_tag tag, const std::complex<float> &value) {
     std::stringstream s;
-    auto value = this->at(tag);
     bool special_annot = false;
-    if (tag == "P") {
+    if (tag == ANNOTATION_TAG_P) {
         special_annot = true;
         if (value == std::complex<float>(0)) { s << "H"; }
         else if (value == std::complex<float>(pi)) { s << "V"; }
@@ -144,32 +367,141 @@ std::string annotation::str_value(const std::string &tag) const {
     return s.str();
 }
 
+std::string annotation::str_value(const std::string &tag) const {
+    auto it = find(tag);
+    if (it == end())
+        throw std::out_of_range("unknown annotation tag");
+    return value_str(it.entry().tag, it.entry().value);
+}
+
 std::string annotation::to_str() const {
-    std::stringstream s;
-    bool first = true;
-    for(auto nv_iter: (*this)) {
-        if (!first) s << ","; else first=false;
-        s << nv_iter.first << ":";
-        s << str_value(nv_iter.first);
+    std::string s;
+    const annotation_entry *d = _data();
+    for (int i = 0; i < _size; i++) {
+        if (i) s += ",";
+        s += tag_name(d[i].tag) + ":" + value_str(d[i].tag, d[i].value);
     }
-    return s.str();
+    return s;
 }
 
 bool annotation::compatible_annotation(const annotation &add_annot, annotation &new_annot) const {
     new_annot = *this;
-    for (auto const &iter: add_annot) {
-        if (iter.first == "P") continue;
-        if (this->find(iter.first) == this->end())
-            new_annot[iter.first] = iter.second;
-        else {
-            if (this->at(iter.first) != iter.second)
-                return false;
-        }
+    for (const annotation_entry *e = add_annot._data(); e != add_annot._data()+add_annot._size; e++) {
+        if (e->tag == ANNOTATION_TAG_P) continue;
+        const annotation_entry *own = _find(e->tag);
+        if (!own)
+            new_annot._insert(e->tag, e->value);
+        else if (own->value != e->value)
+            return false;
     }
     return true;
 }
 
 std::complex<float> annotation::get(const std::string &tag, std::complex<float> def) const {
-    if (find(tag) == this->end()) return def;
-    return at(tag);
+    auto it = find(tag);
+    if (it == end()) return def;
+    return it.entry().value;
+}
+
+namespace {
+    struct pool_entry {
+        pool_entry(const annotation &a, std::string s): annot(a), str(std::move(s)),
+                                                         polarization(a.has_polarization()) {}
+        annotation annot;
+        std::string str;
+        bool polarization;
+    };
+
+    /* marker of incompatible pairs in the merge cache */
+    constexpr annot_id no_merge = ~annot_id(0);
+
+    struct pool_data {
+        pool_data() {
+            entries.emplace_back(annotation(), std::string());
+            index[""] = 0;
+            order.push_back(order_key{0, &entries.back().str});
+        }
+        std::mutex lock;
+        /* deque does not move its elements, references to entries remain valid when the pool grows */
+        std::deque<pool_entry> entries;
+        std::unordered_map<std::string, annot_id> index;
+        std::unordered_map<uint64_t, annot_id> merges;
+        /* order of the canonical form of each id, read without the lock */
+        append_only_table<order_key> order;
+
+        annot_id intern(const annotation &a) {
+            std::string s = a.to_str();
+            auto it = index.find(s);
+            if (it != index.end()) return it->second;
+            auto id = annot_id(entries.size());
+            entries.emplace_back(a, s);
+            order.push_back(order_key{order_prefix(s), &entries.back().str});
+            index.emplace(std::move(s), id);
+            return id;
+        }
+    };
+
+    pool_data &pool() {
+        static pool_data data;
+        return data;
+    }
+}
+
+annot_id annotation_pool::intern(const annotation &a) {
+    if (a.empty()) return 0;
+    auto &p = pool();
+    std::lock_guard<std::mutex> guard(p.lock);
+    return p.intern(a);
+}
+
+const annotation &annotation_pool::get(annot_id id) {
+    auto &p = pool();
+    std::lock_guard<std::mutex> guard(p.lock);
+    return p.entries.at(id).annot;
+}
+
+const std::string &annotation_pool::str(annot_id id) {
+    auto &p = pool();
+    std::lock_guard<std::mutex> guard(p.lock);
+    return p.entries.at(id).str;
+}
+
+bool annotation_pool::less(annot_id a, annot_id b) {
+    auto &p = pool();
+    return order_less(p.order[a], p.order[b]);
+}
+
+bool annotation_pool::has_polarization(annot_id id) {
+    if (!id) return false;
+    auto &p = pool();
+    std::lock_guard<std::mutex> guard(p.lock);
+    return p.entries.at(id).polarization;
+}
+
+bool annotation_pool::compatible(annot_id a, annot_id add, annot_id &merged) {
+    /* adding nothing or the same annotation never conflicts */
+    if (!add || a == add) {
+        merged = a;
+        return true;
+    }
+    auto &p = pool();
+    std::lock_guard<std::mutex> guard(p.lock);
+    uint64_t key = (uint64_t(a) << 32) | add;
+    auto it = p.merges.find(key);
+    if (it == p.merges.end()) {
+        annotation new_annot;
+        annot_id result = no_merge;
+        if (p.entries.at(a).annot.compatible_annotation(p.entries.at(add).annot, new_annot))
+            result = new_annot.empty() ? 0 : p.intern(new_annot);
+        it = p.merges.emplace(key, result).first;
+    }
+    if (it->second == no_merge) return false;
+    merged = it->second;
+    return true;
+}
+
+size_t annotation_pool::size() {
+    auto &p = pool();
+    std::lock_guard<std::mutex> guard(p.lock);
+    return p.entries.size();
 }
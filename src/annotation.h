@@ -23,36 +23,138 @@
 #ifndef ANNOTATION_H
 #define ANNOTATION_H
 
-#include <map>
 #include <string>
 #include <complex>
+#include <cstdint>
+#include <memory>
+#include <utility>
 
-class annotation : public std::map<std::string, std::complex<float>> {
+/* id of an interned annotation tag - the polarization tag "P" is always ANNOTATION_TAG_P */
+typedef uint32_t annot_tag;
+#define ANNOTATION_TAG_P 0
+
+/* number of tags stored directly in the annotation object - larger annotations use a heap buffer */
+#define ANNOTATION_INLINE_TAGS 4
+
+struct annotation_entry {
+    annot_tag tag;
+    std::complex<float> value;
+};
+
+/**
+ * key-value annotation: a small array of (interned tag, value) entries sorted by tag name, so that copy, comparison
+ * and merge of usual annotations work on the inline array without allocation nor string comparison
+ */
+class annotation {
     public:
+        typedef std::pair<std::string, std::complex<float>> value_type;
+        class const_iterator {
+            public:
+                typedef const_iterator self_type;
+                const_iterator(const annotation_entry *p): _p(p) {}
+                self_type &operator++() { _p++; return *this; }
+                self_type operator++(int) { self_type it(*this); _p++; return it; }
+                value_type operator*() const { return value_type(tag_name(_p->tag), _p->value); }
+                const annotation_entry &entry() const { return *_p; }
+                bool operator==(const self_type &rhs) const { return _p == rhs._p; }
+                bool operator!=(const self_type &rhs) const { return _p != rhs._p; }
+            private:
+                const annotation_entry *_p;
+        };
+
         /* empty annotation */
-        annotation() {}
+        annotation(): _size(0), _capacity(ANNOTATION_INLINE_TAGS) {}
         /* read a key-value KEY1:VALUE1,KEY2:VALUE2,... annotation */
         explicit annotation(const char *str);
-        annotation(const std::string &name, const std::complex<float> &value) { (*this)[name] = value; }
+        annotation(const std::string &name, const std::complex<float> &value): annotation() {
+            (*this)[name] = value;
+        }
+        annotation(const annotation &);
+        annotation(annotation &&) noexcept;
+        annotation &operator=(const annotation &);
+        annotation &operator=(annotation &&) noexcept;
+
         std::string to_str() const;
         bool has_tag(const std::string &name) const {
-            return this->find(name) != this->end();
+            return find(name) != end();
         }
         bool has_polarization() const {
-            return has_tag("P");
+            return _find(ANNOTATION_TAG_P) != nullptr;
         }
-        bool operator==(const annotation &b) {
-            if (b.size() != this->size()) return false;
-            for(auto it: *this) {
-                if (b.find(it.first) == b.end()) return false;
-                if (it.second != b.at(it.first)) return false;
-            }
-            return true;
-        }
-        bool contains(const std::string &tag) const { return find(tag) != end(); }
+        bool operator==(const annotation &b) const;
+        bool operator!=(const annotation &b) const { return !(*this == b); }
+        bool contains(const std::string &tag) const { return has_tag(tag); }
         std::complex<float> get(const std::string &tag, std::complex<float> def) const;
         std::string str_value(const std::string &tag) const;
         bool compatible_annotation(const annotation &add_annot, annotation &new_annot) const;
+
+        /* map-like access to the tag values */
+        size_t size() const { return _size; }
+        bool empty() const { return _size == 0; }
+        const_iterator begin() const { return {_data()}; }
+        const_iterator end() const { return {_data() + _size}; }
+        const_iterator find(const std::string &name) const;
+        const std::complex<float> &at(const std::string &name) const;
+        /* value of the tag, inserted with value 0 if not present */
+        std::complex<float> &operator[](const std::string &name);
+
+        /* value of an interned tag, nullptr if not present */
+        const std::complex<float> *value(annot_tag tag) const {
+            const annotation_entry *e = _find(tag);
+            return e ? &e->value : nullptr;
+        }
+        /* set the value of an interned tag */
+        void set(annot_tag tag, const std::complex<float> &value);
+
+        /* global table of tag names - ids remain valid for the life of the process, and their names are read without
+         * locking the table */
+        static annot_tag intern_tag(const std::string &name);
+        /* id of a tag, -1 if the tag has never been interned */
+        static long find_tag(const std::string &name);
+        static const std::string &tag_name(annot_tag tag);
+    private:
+        inline const annotation_entry *_data() const { return _heap ? _heap.get() : _inline; }
+        inline annotation_entry *_data() { return _heap ? _heap.get() : _inline; }
+        inline const annotation_entry *_find(annot_tag tag) const {
+            const annotation_entry *d = _data();
+            for (int i = 0; i < _size; i++)
+                if (d[i].tag == tag) return d+i;
+            return nullptr;
+        }
+        /* position of the tag with this name, -1 if not present */
+        int _find_name(const std::string &name) const;
+        /* insert a new tag at its position in the name order */
+        annotation_entry &_insert(annot_tag tag, const std::complex<float> &value);
+        int _size;
+        int _capacity;
+        annotation_entry _inline[ANNOTATION_INLINE_TAGS];
+        std::unique_ptr<annotation_entry[]> _heap;
+};
+
+/* id of an interned annotation - 0 is the empty annotation */
+typedef uint32_t annot_id;
+
+/**
+ * process-wide table of interned annotations: each distinct annotation, compared on its canonical form to_str(), is
+ * stored once and identified by a small id that remains valid for the life of the process - thread-safe
+ */
+class annotation_pool {
+    public:
+        static annot_id intern(const annotation &a);
+        /* interned annotation, the reference remains valid for the life of the process */
+        static const annotation &get(annot_id id);
+        /* canonical form of the annotation, as returned by annotation::to_str() */
+        static const std::string &str(annot_id id);
+        /* order of the canonical forms of the annotations, without locking the pool */
+        static bool less(annot_id a, annot_id b);
+        static bool has_polarization(annot_id id);
+        /**
+         * same as annotation::compatible_annotation on interned annotations, memoized on the pair of ids
+         * @return false if the annotations are not compatible, otherwise the merged annotation is returned in merged
+         */
+        static bool compatible(annot_id a, annot_id add, annot_id &merged);
+        /* number of interned annotations, including the empty annotation */
+        static size_t size();
 };
 
 #endif
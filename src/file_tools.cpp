@@ -0,0 +1,126 @@
+// MIT License
+//
+// Copyright (c) 2022 Quandela
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#include <windows.h>
+#endif
+
+#include "file_tools.h"
+
+mapped_file::mapped_file(const std::string &path):_data(nullptr), _size(0), _mapped(false) {
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("cannot open file "+path);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        throw std::runtime_error("cannot read file "+path);
+    }
+    _size = size_t(st.st_size);
+    if (_size) {
+        void *p = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("cannot map file "+path);
+        }
+        _data = static_cast<const char *>(p);
+        _mapped = true;
+    }
+    /* the mapping stays valid once the descriptor is closed */
+    close(fd);
+#else
+    std::ifstream f(path, std::ios::binary | std::ios::ate);
+    if (!f)
+        throw std::runtime_error("cannot open file "+path);
+    _size = size_t(f.tellg());
+    char *data = new char[_size ? _size : 1];
+    f.seekg(0);
+    if (!f.read(data, std::streamsize(_size))) {
+        delete [] data;
+        throw std::runtime_error("cannot read file "+path);
+    }
+    _data = data;
+#endif
+}
+
+mapped_file::~mapped_file() {
+#ifndef _WIN32
+    if (_mapped)
+        munmap(const_cast<char *>(_data), _size);
+#else
+    delete [] _data;
+#endif
+}
+
+unsigned long long file_checksum(const char *data, size_t size, unsigned long long seed) {
+    unsigned long long h = seed;
+    for(size_t i=0; i<size; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+void replace_file(const std::string &tmp_path, const std::string &path) {
+#ifndef _WIN32
+    bool replaced = std::rename(tmp_path.c_str(), path.c_str()) == 0;
+#else
+    /* std::rename does not replace an existing file on Windows */
+    bool replaced = MoveFileExA(tmp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#endif
+    if (!replaced) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("cannot write file "+path);
+    }
+}
+
+std::string resolve_file_path(const std::string &path, const char *default_format, int m, int n) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !(st.st_mode & S_IFDIR))
+        return path;
+    char filename[64];
+    snprintf(filename, sizeof(filename), default_format, m, n);
+    if (!path.empty() && path.back() != '/' && path.back() != '\\')
+        return path+"/"+filename;
+    return path+filename;
+}
+
+void put_le(char *dest, unsigned long long value, int bytes) {
+    for(int i=0; i<bytes; i++, value >>= 8)
+        dest[i] = char(value & 0xff);
+}
+
+unsigned long long get_le(const char *src, int bytes) {
+    unsigned long long value = 0;
+    for(int i=bytes-1; i>=0; i--)
+        value = (value << 8) | (unsigned char)src[i];
+    return value;
+}
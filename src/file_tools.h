@@ -0,0 +1,69 @@
+// MIT License
+//
+// Copyright (c) 2022 Quandela
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef QUANDELIBC_FILE_TOOLS_H
+#define QUANDELIBC_FILE_TOOLS_H
+
+#include <cstddef>
+#include <string>
+
+/* size of the fixed header of the fs_array and fs_map files */
+#define FILE_HEADER_SIZE 32
+
+/**
+ * read-only view of a whole file, memory-mapped so that large files are loaded lazily and shared between processes
+ * through the page cache - read in memory where mmap is not available
+ * @throws std::runtime_error if the file cannot be opened
+ */
+class mapped_file {
+public:
+    explicit mapped_file(const std::string &path);
+    ~mapped_file();
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+    inline const char *data() const { return _data; }
+    inline size_t size() const { return _size; }
+private:
+    const char *_data;
+    size_t _size;
+    bool _mapped;
+};
+
+/* 64-bit FNV-1a checksum of data, continuing from seed */
+unsigned long long file_checksum(const char *data, size_t size,
+                                 unsigned long long seed=0xcbf29ce484222325ULL);
+
+/**
+ * move tmp_path over path in a single step, so that the processes mapping the previous file keep reading its content
+ * - tmp_path is removed on failure
+ * @throws std::runtime_error if the file cannot be replaced
+ */
+void replace_file(const std::string &tmp_path, const std::string &path);
+
+/* path itself, or the file named after default_format, m and n in path if it is a directory */
+std::string resolve_file_path(const std::string &path, const char *default_format, int m, int n);
+
+/* little-endian encoding of the header fields, independent of the host */
+void put_le(char *dest, unsigned long long value, int bytes);
+unsigned long long get_le(const char *src, int bytes);
+
+#endif //QUANDELIBC_FILE_TOOLS_H
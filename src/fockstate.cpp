@@ -25,7 +25,9 @@
 #include <algorithm>
 #include <sstream>
 #include <map>
+#include <cmath>
 #include "fockstate.h"
+#include "thread_tools.h"
 
 /* one-byte memory space that is used as pointer to 0-size fockstate buffer */
 static char n0_buffer[1];
@@ -35,10 +37,10 @@ const char * skip_blanks(const char * str) {
     return str;
 }
 
-fockstate::fockstate(): _m(0), _n(0), _code(nullptr), _owned_data(true) {
+fockstate::fockstate(): _m(0), _n(0), _code(nullptr) {
 }
 
-fockstate::fockstate(int m): _m(m), _n(0), _code(n0_buffer), _owned_data(false) {
+fockstate::fockstate(int m): _m(m), _n(0), _code(n0_buffer) {
 }
 
 void fockstate::_parse_str(const char *str) {
@@ -50,6 +52,8 @@ void fockstate::_parse_str(const char *str) {
         throw std::invalid_argument("invalid fock state representation");
     str += 1;
     std::vector<int> fs_vect;
+    std::vector<annot_id> annot_ids;
+    bool annotated = false;
     while (true) {
         str = skip_blanks(str);
         if (!*str || !strchr("0123456789,{", *str) ||
@@ -58,9 +62,9 @@ void fockstate::_parse_str(const char *str) {
             str = skip_blanks(++str);
         }
         int total_cn = 0;
-        std::map<std::string, std::pair<int, annotation*>> count_annot_map;
+        size_t mode_first = annot_ids.size();
         while (std::isdigit(*str) || *str == '{') {
-            annotation *pa = nullptr;
+            annot_id id = 0;
             int cn = 0;
             if (*str == '{') {
                 cn = 1;
@@ -77,36 +81,15 @@ void fockstate::_parse_str(const char *str) {
                 if (!str[j])
                     throw std::invalid_argument("invalid fock state representation (no annotation close)");
                 std::string sa(str + 1, j - 1);
-                pa = new annotation(sa.c_str());
+                id = annotation_pool::intern(annotation(sa.c_str()));
+                if (id) annotated = true;
                 str += j + 1;
             }
-            if (pa) {
-                std::string annot_str = pa->to_str();
-                if (annot_str.empty()) {
-                    delete pa;
-                }
-                else if (count_annot_map.find(annot_str) == count_annot_map.end())
-                    count_annot_map[annot_str] = std::make_pair(cn, pa);
-                else {
-                    count_annot_map[annot_str].first += cn;
-                    delete pa;
-                }
-            }
-            for (int i = 0; i < cn; i++) {
-                total_cn++;
-            }
+            annot_ids.insert(annot_ids.end(), cn, id);
+            total_cn += cn;
         }
         _n += total_cn;
-        if (!count_annot_map.empty()) {
-            if (_annotation_map.find(fs_vect.size()) == _annotation_map.end())
-                _annotation_map[fs_vect.size()] = std::list<std::pair<int, annotation*>>();
-            for (auto iter: count_annot_map) {
-                auto annot = iter.first;
-                auto pair_count_annot = iter.second;
-                _annotation_map[fs_vect.size()].push_back(std::make_pair(pair_count_annot.first,
-                                                                         pair_count_annot.second));
-            }
-        }
+        _sort_annotation_ids(annot_ids.data() + mode_first, annot_ids.data() + annot_ids.size());
         fs_vect.push_back(total_cn);
     }
     if (fs_vect.empty() && *str==',') {
@@ -128,27 +111,21 @@ void fockstate::_parse_str(const char *str) {
     if (*str)
         throw std::invalid_argument("invalid fock state representation (extra chars)");
     if (_m) {
-        _owned_data = false;
         _code = nullptr;
         return;
     }
     _m = fs_vect.size();
-    if (_n) {
-        _owned_data = true;
-        _code = new char[_n];
-        int k = 0;
-        for (int i = 0; i < _m; i++)
-            for (int j = 0; j < fs_vect[i]; j++)
-                _code[k++] = char(i + 'A');
-    } else {
-        _owned_data = false;
-        _code = n0_buffer;
-    }
+    _alloc_code(_n);
+    int k = 0;
+    for (int i = 0; i < _m; i++)
+        for (int j = 0; j < fs_vect[i]; j++)
+            _set_mode_at(k++, i);
+    if (annotated)
+        _set_annotation_ids(std::move(annot_ids));
 }
 
 void fockstate::_set_annotations(const std::map<int, std::list<std::string>> &annotations) {
     for(const auto& iter: annotations) {
-        std::map<std::string, std::pair<int, annotation *>> mode_annotations;
         int m_k = iter.first;
         std::list<annotation> la;
         for(auto &annot_str: iter.second)
@@ -157,87 +134,139 @@ void fockstate::_set_annotations(const std::map<int, std::list<std::string>> &an
     }
 }
 
-fockstate::fockstate(const char *str)
-    : _code(nullptr), _owned_data(false)
-{
+fockstate::fockstate(const char *str): _code(nullptr) {
     _parse_str(str);
 }
 
-fockstate::fockstate(const char *str, const std::map<int, std::list<std::string>> &annotations)
-    : _code(nullptr), _owned_data(false)
-{
+fockstate::fockstate(const char *str, const std::map<int, std::list<std::string>> &annotations): _code(nullptr) {
     _parse_str(str);
     _set_annotations(annotations);
 }
 
+char *fockstate::_alloc_code(int n) {
+    _shared_code.reset();
+    if (n && _m > FS_MAX_M)
+        throw std::invalid_argument("too many modes");
+    int size = n * code_width(_m);
+    if (!size)
+        _code = n0_buffer;
+    else if (size <= FS_INLINE_CODE)
+        _code = _inline_code;
+    else {
+        _shared_code = std::shared_ptr<char>(new char[size], std::default_delete<char[]>());
+        _code = _shared_code.get();
+    }
+    return _code;
+}
 
-fockstate::fockstate(const fockstate &b):_m(b._m), _n(b._n) {
-    if (b._code) {
-        if (_n) {
-            _code = new char[_n];
-            memcpy(_code, b._code, _n);
-            _owned_data = true;
-        } else {
-            _code = n0_buffer;
-            _owned_data = false;
-        }
-        for(const auto& iter: b._annotation_map) {
-            auto idx = iter.first;
-            auto &la = iter.second;
-            _annotation_map[idx] = std::list<std::pair<int, annotation*>>();
-            for(auto p: la) {
-                _annotation_map[idx].push_back(std::make_pair(p.first, new annotation(*p.second)));
-            }
-        }
-    } else {
-        _code = nullptr;
+void fockstate::_free_code() {
+    _shared_code.reset();
+    _code = nullptr;
+}
+
+void fockstate::_copy_code(const fockstate &b) {
+    /* share heap buffer, copy inline buffer and data viewed from external buffers */
+    if (b._shared_code) {
+        _shared_code = b._shared_code;
+        _code = b._code;
+    } else if (b._code)
+        memcpy(_alloc_code(b._n), b._code, b.get_code_size());
+    else
+        _free_code();
+}
+
+void fockstate::_detach_code() {
+    if (_writable_code() || !_code) return;
+    /* keep the current buffer alive during the copy */
+    std::shared_ptr<char> current_shared(_shared_code);
+    const char *current_code = _code;
+    memcpy(_alloc_code(_n), current_code, get_code_size());
+}
+
+void fockstate::_set_annotation_ids(std::vector<annot_id> &&ids) {
+    if (std::all_of(ids.begin(), ids.end(), [](annot_id id) { return id == 0; }))
+        _annotations.reset();
+    else
+        _annotations = std::make_shared<const std::vector<annot_id>>(std::move(ids));
+}
+
+void fockstate::_sort_annotation_ids(annot_id *begin, annot_id *end) {
+    if (end - begin < 2) return;
+    std::sort(begin, end, [](annot_id a, annot_id b) {
+        if (a == b || !a) return false;
+        if (!b) return true;
+        return annotation_pool::less(a, b);
+    });
+}
+
+void fockstate::_canonical_annotations() {
+    if (!_annotations || !_code) return;
+    std::vector<annot_id> ids(*_annotations);
+    for(int i=0; i<_n;) {
+        int k = i+1;
+        while (k < _n && _mode_at(k) == _mode_at(i)) k++;
+        _sort_annotation_ids(ids.data()+i, ids.data()+k);
+        i = k;
+    }
+    _set_annotation_ids(std::move(ids));
+}
+
+fockstate::fockstate(const fockstate &b):_m(b._m), _n(b._n), _code(nullptr), _annotations(b._annotations),
+                                         _hash(b._hash.load(std::memory_order_relaxed)) {
+    _copy_code(b);
+}
+
+fockstate::fockstate(fockstate &&b) noexcept:_m(b._m), _n(b._n), _code(b._code),
+                                             _shared_code(std::move(b._shared_code)),
+                                             _annotations(std::move(b._annotations)),
+                                             _hash(b._hash.load(std::memory_order_relaxed)) {
+    if (b._code == b._inline_code) {
+        memcpy(_inline_code, b._inline_code, get_code_size());
+        _code = _inline_code;
     }
+    b._m = b._n = 0;
+    b._code = nullptr;
 }
 
 fockstate &fockstate::operator=(const fockstate &b) {
     if (&b == this) return *this;
-    if (_owned_data && _code) {
-        delete [] _code;
-    }
-    clear_annotations();
-    for(const auto& iter: b._annotation_map) {
-        auto idx = iter.first;
-        auto &la = iter.second;
-        _annotation_map[idx] = std::list<std::pair<int, annotation*>>();
-        for(auto const & p: la)
-            _annotation_map[idx].push_back(std::make_pair(p.first, new annotation(*p.second)));
-    }
-    _n = b._n;
     _m = b._m;
-    if (b._code) {
-        if (_n) {
-            _code = new char[_n];
-            memcpy(_code, b._code, _n);
-            _owned_data = true;
-        } else {
-            _code = n0_buffer;
-            _owned_data = false;
-        }
-    } else
-        _code = nullptr;
+    _n = b._n;
+    _copy_code(b);
+    _annotations = b._annotations;
+    _hash.store(b._hash.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return *this;
+}
 
+fockstate &fockstate::operator=(fockstate &&b) noexcept {
+    if (&b == this) return *this;
+    _m = b._m;
+    _n = b._n;
+    if (b._code == b._inline_code) {
+        _shared_code.reset();
+        memcpy(_inline_code, b._inline_code, get_code_size());
+        _code = _inline_code;
+    } else {
+        _shared_code = std::move(b._shared_code);
+        _code = b._code;
+    }
+    _annotations = std::move(b._annotations);
+    _hash.store(b._hash.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    b._hash.store(0, std::memory_order_relaxed);
+    b._m = b._n = 0;
+    b._code = nullptr;
+    b._shared_code.reset();
     return *this;
 }
 
 void fockstate::_set_fs_vect(const std::vector<int> &fs_vect) {
     _n = 0;
     for (int i = 0; i < _m; i++) _n += fs_vect[i];
-    if (!_n) {
-        _code = n0_buffer;
-        _owned_data = false;
-        return;
-    }
-    _code = new char[_n];
-    _owned_data = true;
+    _alloc_code(_n);
     int k = 0;
     for (int i = 0; i < _m; i++)
         for (int j = 0; j < fs_vect[i]; j++)
-            _code[k++] = char(i + 65);
+            _set_mode_at(k++, i);
 }
 
 fockstate::fockstate(const std::vector<int> &fs_vect):_m(int(fs_vect.size())) {
@@ -251,31 +280,17 @@ fockstate::fockstate(const std::vector<int> &fs_vect,
 }
 
 fockstate::fockstate(int m, int n): _m(m), _n(n) {
-    if (!_n) {
-        _code = n0_buffer;
-        _owned_data = false;
-        return;
-    }
-    _code = new char[_n];
-    _owned_data = true;
-    ::memset(_code, 'A', _n);
+    _alloc_code(_n);
+    for (int k = 0; k < _n; k++)
+        _set_mode_at(k, 0);
 }
 
-fockstate::fockstate(int m, int n, const char *code, bool owned_data):_m(m), _n(n), _code((char*)code),
-                                                                      _owned_data(owned_data) {
+fockstate::fockstate(int m, int n, const char *code, bool owned_data):_m(m), _n(n), _code((char*)code) {
+    if (owned_data)
+        _shared_code = std::shared_ptr<char>(_code, std::default_delete<char[]>());
 }
 
-fockstate::fockstate(int m, int n, const char *code, map_m_lannot annots, bool owned_data):
-                                                                      _m(m), _n(n), _code((char*)code),
-                                                                      _owned_data(owned_data),
-                                                                      _annotation_map(std::move(annots)) {
-}
-
-fockstate::~fockstate() {
-    if (_owned_data && _code)
-        delete [] _code;
-    clear_annotations();
-}
+fockstate::~fockstate() = default;
 
 fockstate fockstate::copy() const {
     return {*this};
@@ -284,7 +299,7 @@ fockstate fockstate::copy() const {
 std::vector<int> fockstate::to_vect() const {
     std::vector<int> fs_vect(_m);
     for(int i=0;i<_n; i++)
-        fs_vect[_code[i]-65]++;
+        fs_vect[_mode_at(i)]++;
     return fs_vect;
 }
 
@@ -292,17 +307,67 @@ void fockstate::to_vect(std::vector<int> &fs_vect) const {
     fs_vect.resize(_m);
     std::fill(fs_vect.begin(), fs_vect.end(), 0);
     for(int i=0;i<_n; i++)
-        fs_vect[_code[i]-65]++;
+        fs_vect[_mode_at(i)]++;
 }
 
 fockstate fockstate::operator+(int c) const {
     if (!_code)
         throw std::invalid_argument("cannot make operation on ndef-state");
     fockstate fs(*this);
-    while (c) {
-        ++fs;
-        c--;
+    fs += c;
+    return fs;
+}
+
+/* the code c_0 <= ... <= c_(n-1) is mapped on the combination d_p = c_p+p of n elements in [0, m+n-1) which keeps
+ * the lexicographic order, so that: rank = C(m+n-1, n) - 1 - sum_p C(x_p+b_p-1, b_p) with x_p = m-1-c_p and
+ * b_p = n-p. Along the walk, val = C(X+B-1, X-1) is updated multiplicatively: X and B are monotonous so that the
+ * walk is O(m+n) - as for fs_array count, intermediate products limit the computation to about C(m+n-1,n) < 2^56 */
+unsigned long long fockstate::count_states(int m, int n) {
+    if (m < 1) return n ? 0 : 1;
+    unsigned long long count = 1;
+    for (int nk = 1; nk <= n; nk++)
+        count = (count * (nk + m - 1)) / nk;
+    return count;
+}
+
+unsigned long long fockstate::rank() const {
+    if (!_code)
+        throw std::invalid_argument("cannot make operation on ndef-state");
+    unsigned long long X = 1, B = 0, val = 1, sum = 0;
+    for (int p = _n-1; p >= 0; p--) {
+        B++;
+        val = val * (X+B-1) / B;
+        unsigned long long x = _m-1-_mode_at(p);
+        for (; X < x; X++)
+            val = val * (X+B) / X;
+        if (x) sum += val;
+    }
+    for (; X < (unsigned long long)_m; X++)
+        val = val * (X+B) / X;
+    return val-1-sum;
+}
+
+void fockstate::_unrank_code(unsigned long long idx, unsigned long long total) {
+    unsigned long long X = _m, B = _n, val = total;
+    unsigned long long remain = total-1-idx;
+    for (int p = 0; p < _n; p++, B--) {
+        while (X && val > remain) {
+            X--;
+            val = X ? val * X / (X+B) : 0;
+        }
+        _set_mode_at(p, int(_m-1-X));
+        remain -= val;
+        if (X) val = val * B / (X+B-1);
     }
+    _hash.store(0, std::memory_order_relaxed);
+}
+
+fockstate fockstate::unrank(int m, int n, unsigned long long idx) {
+    unsigned long long total = count_states(m, n);
+    if (idx >= total)
+        throw std::out_of_range("index too large");
+    fockstate fs(m, n);
+    fs._unrank_code(idx, total);
     return fs;
 }
 
@@ -310,139 +375,199 @@ fockstate &fockstate::operator++() {
     if (!_code)
         throw std::invalid_argument("cannot make operation on ndef-state");
     int i;
-    for(i=_n-1; i>=0 && _code[i]==_m-1+'A'; i--);
+    _hash.store(0, std::memory_order_relaxed);
+    for(i=_n-1; i>=0 && _mode_at(i)==_m-1; i--);
     if (i<0) {
-        if (_owned_data)
-            delete [] _code;
-        _code = nullptr;
+        _free_code();
         return *this;
     }
-    if (!_owned_data) {
-        char *_new_code = new char[_n];
-        memcpy(_new_code, _code, _n);
-        _code = _new_code;
-        _owned_data = true;
-    }
-    _code[i] += 1;
-    for(int j=i+1; j<_n; j++)
-        _code[j] = _code[i];
+    _detach_code();
+    int c = _mode_at(i)+1;
+    for(int j=i; j<_n; j++)
+        _set_mode_at(j, c);
+    /* annotations follow the photons */
+    _canonical_annotations();
     return *this;
 }
 
+/* encode the occupations of a state in code, returning the number of photons - code is large enough for max_n */
+static int encode_occupations(const int *occupations, int m, int max_n, char *code) {
+    int width = fockstate::code_width(m);
+    int k = 0;
+    for (int i = 0; i < m; i++) {
+        if (occupations[i] < 0)
+            throw std::invalid_argument("negative photon count");
+        if (occupations[i] > max_n - k)
+            throw std::invalid_argument("invalid photon count");
+        for (int j = 0; j < occupations[i]; j++)
+            fockstate::encode_mode(code, width, k++, i);
+    }
+    return k;
+}
+
+std::vector<fockstate> fockstate::from_occupations(const int *occupations, size_t count, int m, int nthreads) {
+    std::vector<fockstate> states(count);
+    run_blocks(count, nthreads, [&](size_t start, size_t end) {
+        for (size_t r = start; r < end; r++) {
+            const int *row = occupations + r * m;
+            fockstate &fs = states[r];
+            fs._m = m;
+            fs._n = 0;
+            for (int i = 0; i < m; i++) {
+                if (row[i] < 0)
+                    throw std::invalid_argument("negative photon count");
+                fs._n += row[i];
+            }
+            encode_occupations(row, m, fs._n, fs._alloc_code(fs._n));
+        }
+    });
+    return states;
+}
+
+std::vector<fockstate> fockstate::from_strings(const std::vector<std::string> &strs, int nthreads) {
+    std::vector<fockstate> states(strs.size());
+    run_blocks(strs.size(), nthreads, [&](size_t start, size_t end) {
+        for (size_t r = start; r < end; r++)
+            states[r]._parse_str(strs[r].c_str());
+    });
+    return states;
+}
+
+void fockstate::pack_occupations(const int *occupations, size_t count, int m, int n, char *codes, int nthreads) {
+    if (n && m > FS_MAX_M)
+        throw std::invalid_argument("too many modes");
+    size_t state_size = size_t(n) * code_width(m);
+    run_blocks(count, nthreads, [&](size_t start, size_t end) {
+        for (size_t r = start; r < end; r++)
+            if (encode_occupations(occupations + r * m, m, n, codes + r * state_size) != n)
+                throw std::invalid_argument("invalid photon count");
+    });
+}
+
+fockstate fockstate::create(int mode, double &amplitude) const {
+    if (!_code)
+        throw std::invalid_argument("cannot make operation on ndef-state");
+    if (mode < 0 || mode >= _m)
+        throw std::out_of_range("mode index out of range");
+    /* the new photon is inserted after the photons of its mode */
+    int p = _first_photon(mode+1);
+    amplitude = sqrt(double(p - _first_photon(mode) + 1));
+    fockstate fs(_m);
+    fs._n = _n+1;
+    fs._alloc_code(fs._n);
+    int width = get_code_width();
+    memcpy(fs._code, _code, p*width);
+    fs._set_mode_at(p, mode);
+    memcpy(fs._code+(p+1)*width, _code+p*width, (_n-p)*width);
+    if (_annotations) {
+        std::vector<annot_id> ids(fs._n);
+        std::copy(_annotations->begin(), _annotations->begin()+p, ids.begin());
+        std::copy(_annotations->begin()+p, _annotations->end(), ids.begin()+p+1);
+        fs._set_annotation_ids(std::move(ids));
+    }
+    return fs;
+}
+
+fockstate fockstate::annihilate(int mode, double &amplitude) const {
+    if (!_code)
+        throw std::invalid_argument("cannot make operation on ndef-state");
+    if (mode < 0 || mode >= _m)
+        throw std::out_of_range("mode index out of range");
+    int p = _first_photon(mode+1);
+    int n_k = p - _first_photon(mode);
+    amplitude = sqrt(double(n_k));
+    fockstate fs(_m);
+    if (!n_k) {
+        fs._free_code();
+        return fs;
+    }
+    p--;
+    fs._n = _n-1;
+    fs._alloc_code(fs._n);
+    int width = get_code_width();
+    memcpy(fs._code, _code, p*width);
+    memcpy(fs._code+p*width, _code+(p+1)*width, (_n-p-1)*width);
+    if (_annotations) {
+        std::vector<annot_id> ids(fs._n);
+        std::copy(_annotations->begin(), _annotations->begin()+p, ids.begin());
+        std::copy(_annotations->begin()+p+1, _annotations->end(), ids.begin()+p);
+        fs._set_annotation_ids(std::move(ids));
+    }
+    return fs;
+}
+
 fockstate fockstate::operator*(const fockstate &b) const {
     if (!_code || !b._code)
         throw std::invalid_argument("cannot make operation on ndef-state");
-    char *_new_code = new char[_n + b._n];
+    fockstate fs(_m+b._m, _n+b._n);
+    char *_new_code = fs._code;
     int k=0;
+    int width = fs.get_code_width();
     while (k < _n) {
-        _new_code[k] = _code[k];
+        encode_mode(_new_code, width, k, _mode_at(k));
         k++;
     }
     while (k < _n+b._n) {
-        _new_code[k] = b._code[k-_n] + _m;
+        encode_mode(_new_code, width, k, b._mode_at(k-_n) + _m);
         k++;
     }
-    map_m_lannot new_annotation_map;
-    for(const auto& iter: _annotation_map) {
-        auto idx = iter.first;
-        auto list_self_annots = iter.second;
-        new_annotation_map[idx] =  std::list<std::pair<int, annotation*>>();
-        for(auto p_toadd: list_self_annots) {
-            new_annotation_map[idx].push_back(std::make_pair(p_toadd.first, new annotation(*p_toadd.second)));
-        }
-    }
-    for(const auto& iter: b._annotation_map) {
-        auto idx = iter.first;
-        auto list_b_annots = iter.second;
-        new_annotation_map[idx+_m] = std::list<std::pair<int, annotation*>>();
-        for(auto p_toadd: list_b_annots) {
-            new_annotation_map[idx+_m].push_back(std::make_pair(p_toadd.first, new annotation(*p_toadd.second)));
-        }
+    if (_annotations || b._annotations) {
+        std::vector<annot_id> ids(_n+b._n);
+        for(int p=0; p<_n; p++)
+            ids[p] = _annotation_id(p);
+        for(int p=0; p<b._n; p++)
+            ids[_n+p] = b._annotation_id(p);
+        fs._set_annotation_ids(std::move(ids));
     }
-
-    return {_m+b._m, k, _new_code, new_annotation_map, true};
+    return fs;
 }
 
 std::list<annotation> fockstate::get_mode_annotations(int idx) const {
     std::list<annotation> l;
-    auto map_iter = _annotation_map.find(idx);
-    int i=0;
-    if (map_iter != _annotation_map.end()) {
-        for(auto const &p: map_iter->second) {
-            for(int j=0; j<p.first; i++, j++) {
-                l.emplace_back(*p.second);
-            }
-        }
-    }
-    for(; i<(*this)[idx]; i++)
-        l.emplace_back();
+    int start = mode2photon(idx);
+    if (start < 0) return l;
+    int end = _first_photon(idx+1);
+    for(int p=start; p<end; p++)
+        l.push_back(annotation_pool::get(_annotation_id(p)));
     return l;
 }
 
 void fockstate::set_mode_annotations(int m_k, const std::list<annotation> &la) {
     if (m_k < 0 || m_k >= _m)
         throw std::invalid_argument("invalid mode index");
-    _annotation_map[m_k] = std::list<std::pair<int, annotation *>>();
-    std::map<std::string, std::pair<int, annotation *>> mode_annotations;
-    int count_mode_annotations = 0;
-    for(auto &annot: la) {
-        count_mode_annotations += 1;
-        std::string normal_form = annot.to_str();
-        if (mode_annotations.find(normal_form) == mode_annotations.end()) {
-            mode_annotations[normal_form] = std::make_pair(1, new annotation(annot));
-        } else {
-            mode_annotations[normal_form].first += 1;
-        }
-    }
-    if (count_mode_annotations > (*this)[m_k])
+    if (int(la.size()) > (*this)[m_k])
         throw std::invalid_argument("invalid mode annotations");
-
-    _annotation_map[m_k] = std::list<std::pair<int, annotation *>>();
-    for(const auto& iter_annot: mode_annotations) {
-        _annotation_map[m_k].push_back(iter_annot.second);
-    }
+    int first = _first_photon(m_k);
+    int mode_n = _first_photon(m_k+1) - first;
+    std::vector<annot_id> ids(_n);
+    if (_annotations)
+        ids = *_annotations;
+    annot_id *mode_ids = ids.data()+first;
+    int count = 0;
+    for(auto &annot: la)
+        mode_ids[count++] = annotation_pool::intern(annot);
+    for(; count < mode_n; count++)
+        mode_ids[count] = 0;
+    _sort_annotation_ids(mode_ids, mode_ids+count);
+    _set_annotation_ids(std::move(ids));
+    _hash.store(0, std::memory_order_relaxed);
 }
 
 annotation fockstate::get_photon_annotation(int idx) const {
-    int m_k = photon2mode(idx);
-    int first_idx = mode2photon(m_k);
-    int n_k = 0;
-    if (_annotation_map.find(m_k) == _annotation_map.end())
-        return annotation();
-    auto iter = _annotation_map.at(m_k).begin();
-    auto iter_end = _annotation_map.at(m_k).end();
-    while(first_idx < idx) {
-        n_k++;
-        if (iter != iter_end && n_k == iter->first) {
-            iter++;
-            n_k = 0;
-        }
-        first_idx += 1;
-    }
-    if (iter != iter_end) {
-        return annotation(*(iter->second));
-    }
-    return annotation();
+    photon2mode(idx);
+    return annotation_pool::get(_annotation_id(idx));
 }
 
 bool fockstate::has_polarization() const {
-    if (_annotation_map.empty()) return false;
-    for(const auto& iter: _annotation_map) {
-        auto la = iter.second;
-        for(auto const &p: la) {
-            if (p.second->has_polarization()) return true;
-        }
-    }
+    if (!_annotations) return false;
+    for(auto id: *_annotations)
+        if (annotation_pool::has_polarization(id)) return true;
     return false;
 }
 
 void fockstate::clear_annotations() {
-    for(auto& iter: _annotation_map) {
-        auto la = iter.second;
-        for(auto & p: la)
-            delete p.second;
-    }
-    _annotation_map.clear();
+    _annotations.reset();
+    _hash.store(0, std::memory_order_relaxed);
 }
 
 void fockstate::_check_slice(int &start, int &end, int step, int &slice_m, int &slice_n) const {
@@ -453,38 +578,41 @@ void fockstate::_check_slice(int &start, int &end, int step, int &slice_m, int &
     if (start < 0) start = 0;
     if (end < 0) end = 0;
     if (end > _m) end = _m;
+    if (start > _m) start = _m;
     if (!_code)
         throw std::invalid_argument("cannot make operation on ndef-state");
     /* count photons in the slice */
     slice_m = 0;
     for(int i=start; i<end; i+=step)
         slice_m++;
-    slice_n = 0;
-    for(int i=0; i<_n; i++)
-        if (_code[i] >= start+'A' && _code[i] < end+'A' && (step == 1 || (_code[i]-start-'A') % step == 0))
-            slice_n++;
+    if (step == 1)
+        slice_n = photons_in_range(start, end);
+    else {
+        slice_n = 0;
+        for(int i=start; i<end; i+=step)
+            slice_n += (*this)[i];
+    }
 }
 
 fockstate fockstate::slice(int start, int end, int step) const {
     int slice_m, slice_n;
     _check_slice(start, end, step, slice_m, slice_n);
-    if (slice_n == 0)
-        return {slice_m, 0};
-    char *_new_code = new char[slice_n];
-    for(int k=0, i=0; i<_n; i++)
-        if (_code[i] >= start+'A' && _code[i] < end+'A' && (step == 1 || (_code[i]-start-'A') % step == 0)) {
-            _new_code[k++] = (_code[i]-start-'A') / step + 'A';
-        }
-    map_m_lannot new_annotation_map;
-    for(int j=0, i=start; i<end; i+=step, j++) {
-        auto iter = _annotation_map.find(i);
-        if (iter != _annotation_map.end()) {
-            new_annotation_map[j] = std::list<std::pair<int, annotation*>>();
-            for(auto const &p: iter->second)
-                new_annotation_map[j].push_back(std::make_pair(p.first, new annotation(*p.second)));
+    /* the full slice shares the buffers of the current state */
+    if (start == 0 && end == _m && step == 1)
+        return *this;
+    fockstate fs(slice_m, slice_n);
+    std::vector<int> mode_start(_m+1);
+    _mode_starts(mode_start.data());
+    std::vector<annot_id> ids;
+    if (_annotations) ids.resize(slice_n);
+    for(int k=0, j=0, i=start; i<end; i+=step, j++)
+        for(int p=mode_start[i]; p<mode_start[i+1]; p++) {
+            if (_annotations) ids[k] = (*_annotations)[p];
+            fs._set_mode_at(k++, j);
         }
-    }
-    return {slice_m, slice_n, _new_code, new_annotation_map, true};
+    if (_annotations)
+        fs._set_annotation_ids(std::move(ids));
+    return fs;
 }
 
 fockstate fockstate::set_slice(const fockstate &fs, int start, int end) const {
@@ -493,48 +621,46 @@ fockstate fockstate::set_slice(const fockstate &fs, int start, int end) const {
     if (slice_m != fs.get_m())
         throw std::invalid_argument("invalid fockstate to replace in slice");
     int new_n = get_n()-slice_n+fs.get_n();
-    if (new_n == 0)
-        return {get_m(), 0};
-    char *_new_code = new char[new_n];
-    int k = 0;
-    int i = 0; /* iterator on current fockstate */
+    fockstate new_fs(get_m(), new_n);
+    int start_photon = _first_photon(start);
+    int end_photon = std::max(start_photon, _first_photon(end));
+    int width = get_code_width();
     // photons on lower mode
-    for(; _code && i < _n && _code[i] < start+'A'; i++)
-        _new_code[k++] = _code[i];
+    memcpy(new_fs._code, _code, start_photon*width);
     // insert the slice photons
+    int k = start_photon;
     for(int j=0; j < fs._n; j++)
-        _new_code[k++] = fs._code[j]+start;
-    for(;_code && i<_n && _code[i] < end+'A'; i++);
+        new_fs._set_mode_at(k++, fs._mode_at(j)+start);
     // add photons on higher modes
-    for(;_code && i<_n;i++)
-        _new_code[k++] = _code[i];
-    map_m_lannot new_annotation_map;
-    for(const auto& iter: _annotation_map) {
-        auto idx = iter.first;
-        auto la = iter.second;
-        if (int(idx) < start || int(idx) >= end) {
-            new_annotation_map[idx] = std::list<std::pair<int, annotation *>>();
-            for (auto p: la) {
-                new_annotation_map[idx].push_back(std::make_pair(p.first, new annotation(*p.second)));
-            }
-        }
-    }
-    for(const auto& iter: fs._annotation_map) {
-        auto idx = iter.first;
-        auto lb = iter.second;
-        new_annotation_map[idx+start] = std::list<std::pair<int, annotation *>>();
-        for (auto p: lb) {
-            new_annotation_map[idx+start].push_back(std::make_pair(p.first, new annotation(*p.second)));
-        }
+    memcpy(new_fs._code+k*width, _code+end_photon*width, (_n-end_photon)*width);
+    if (_annotations || fs._annotations) {
+        std::vector<annot_id> ids(new_n);
+        for(int p=0; p<start_photon; p++)
+            ids[p] = _annotation_id(p);
+        for(int p=0; p<fs._n; p++)
+            ids[start_photon+p] = fs._annotation_id(p);
+        for(int p=end_photon; p<_n; p++)
+            ids[k+p-end_photon] = _annotation_id(p);
+        new_fs._set_annotation_ids(std::move(ids));
     }
-    return {get_m(), new_n, _new_code, true};
+    return new_fs;
 }
 
 fockstate &fockstate::operator+=(int c) {
-    while (c) {
-        ++(*this);
-        c--;
+    /* jump directly to the state of rank rank()+c - photons keep their annotations, as with operator++ */
+    if (c == 0) return *this;
+    if (c == 1) return ++(*this);
+    unsigned long long idx = rank();
+    unsigned long long total = count_states(_m, _n);
+    if ((c < 0 && (unsigned long long)(-(long long)c) > idx) ||
+        (c > 0 && (unsigned long long)c >= total-idx)) {
+        _free_code();
+        _hash.store(0, std::memory_order_relaxed);
+        return *this;
     }
+    _detach_code();
+    _unrank_code(c < 0 ? idx-(unsigned long long)(-(long long)c) : idx+c, total);
+    _canonical_annotations();
     return *this;
 }
 
@@ -543,7 +669,7 @@ unsigned long long fockstate::prodnfact() const {
     unsigned long long p = 1;
     for(int i=0; i<_n;) {
         int k=1;
-        while (i+k<_n && _code[i+k] == _code[i])
+        while (i+k<_n && _mode_at(i+k) == _mode_at(i))
             p *= ++k;
         i += k;
     }
@@ -551,38 +677,37 @@ unsigned long long fockstate::prodnfact() const {
 }
 
 unsigned long long fockstate::hash() const {
-    return hash_function(this->to_str().c_str());
+    unsigned long long cached = _hash.load(std::memory_order_relaxed);
+    if (cached) return cached;
+    unsigned long long h = hash_mix((unsigned long long)_m);
+    /* consistent with operator==: states with no mode are all equal */
+    if (_code && _m) {
+        h = hash_code(_code, get_code_size(), h);
+        /* annotation ids are in canonical order, so that they can be hashed as a code */
+        if (_annotations)
+            h = hash_code((const char *)_annotations->data(), int(_n * sizeof(annot_id)), h);
+    } else
+        h = hash_mix(~h);
+    /* 0 is reserved for hash not computed */
+    if (!h) h = 1;
+    _hash.store(h, std::memory_order_relaxed);
+    return h;
 }
 
 bool fockstate::operator==(const fockstate &b) const {
     auto const &a = *this;
     if (a._m != b._m || a._n != b._n) return false;
+    /* different hashes cannot be equal states */
+    unsigned long long a_hash = a._hash.load(std::memory_order_relaxed);
+    unsigned long long b_hash = b._hash.load(std::memory_order_relaxed);
+    if (a_hash && b_hash && a_hash != b_hash) return false;
     if (a._m == 0 && b._m == 0) return true;
     if (a._code == nullptr && b._code == nullptr) return true;
     if (a._code == nullptr || b._code == nullptr) return false;
-    for (int i = 0; i < a._n; i++)
-        if (a._code[i] != b._code[i]) return false;
-    if (a._annotation_map.size() != b._annotation_map.size())
-        return false;
-    for (const auto& iter: a._annotation_map) {
-        auto idx = iter.first;
-        auto la = iter.second;
-        auto ilb = b._annotation_map.find(idx);
-        if (ilb == b._annotation_map.end())
-            return false;
-        for (auto const &pa: la) {
-            bool found = false;
-            for (auto const &pb: ilb->second) {
-                if (pa.first == pb.first && pa.second->to_str() == pb.second->to_str()) {
-                    found = true;
-                    break;
-                }
-            }
-            if (!found)
-                return false;
-        }
-    }
-    return true;
+    if (memcmp(a._code, b._code, a.get_code_size()) != 0) return false;
+    if (a._annotations == b._annotations) return true;
+    if (!a._annotations || !b._annotations) return false;
+    return *a._annotations == *b._annotations;
 }
 
 bool fockstate::operator!=(const fockstate &b) const {
@@ -595,22 +720,23 @@ std::string fockstate::to_str(bool show_annotations) const {
     if (_code) {
         std::vector<int> fs_vect(_m);
         std::vector<std::string> annots_vect(_m);
-        for (int i = 0; i < _n; i++) {
-            fs_vect[_code[i] - 'A']++;
-        }
-        if (show_annotations) {
-            for (int i = 0; i < _m; i++) {
-                const auto map_item = _annotation_map.find(i);
-                if (map_item != _annotation_map.end()) {
-                    for (auto const &p: map_item->second) {
-                        std::stringstream s;
-                        int count = p.first;
-                        annotation *a = p.second;
-                        if (count > 1) s << count;
-                        annots_vect[i] += s.str() + "{" + a->to_str() + "}";
-                        fs_vect[i] -= count;
-                    }
+        std::vector<int> mode_start(_m+1);
+        _mode_starts(mode_start.data());
+        for (int i = 0; i < _m; i++)
+            fs_vect[i] = mode_start[i+1] - mode_start[i];
+        if (show_annotations && _annotations) {
+            /* annotated photons come first in each mode, with identical annotations grouped */
+            for (int p = 0; p < _n;) {
+                annot_id id = (*_annotations)[p];
+                int i = _mode_at(p);
+                int count = 1;
+                while (p+count < mode_start[i+1] && (*_annotations)[p+count] == id) count++;
+                if (id) {
+                    if (count > 1) annots_vect[i] += std::to_string(count);
+                    annots_vect[i] += "{" + annotation_pool::str(id) + "}";
+                    fs_vect[i] -= count;
                 }
+                p += count;
             }
         }
         for (int i = 0; i < _m; i++) {
@@ -628,76 +754,104 @@ std::string fockstate::to_str(bool show_annotations) const {
     return ss.str();
 }
 
+int fockstate::_first_photon(int mode) const {
+    if (!_code) return 0;
+    int width = code_width(_m);
+    int low = 0;
+    int high = _n;
+    while (low < high) {
+        int middle = (low+high) >> 1;
+        if (decode_mode(_code, width, middle) < mode) low = middle+1;
+        else high = middle;
+    }
+    return low;
+}
+
+void fockstate::_mode_starts(int *mode_start) const {
+    int k = 0;
+    for(int i=0; i<=_m; i++) {
+        while (_code && k < _n && _mode_at(k) < i) k++;
+        mode_start[i] = k;
+    }
+}
+
 int fockstate::operator[](int idx) const {
     if (idx<0 || idx>=_m)
         throw std::out_of_range("invalid mode");
-    int nc=0;
-    for(int i=0;i<_n && _code[i]-'A'<=idx; i++)
-        if (_code[i]-'A'==idx) nc++;
-    return nc;
+    return _first_photon(idx+1)-_first_photon(idx);
 }
 
-std::list<fockstate> fockstate::separate_state() const {
-    std::list<fockstate> states;
-    if (!_n || !has_annotations())
-        states.push_back(*this);
-    else {
-        /* check which photon needs to be distinguished - if we have n photons, we might end-up with n partitions */
-        std::list<std::pair<annotation, std::list<int>>> photon_groups;
-        int last_mode = -1;
-        std::list<std::pair<int, annotation *>>::const_iterator iter_list;
-        std::list<std::pair<int, annotation *>>::const_iterator iter_list_end;
-        int in_mode_dup = 0;
-        for(int k=0; k<_n; k++) {
-            int m_k = photon2mode(k);
-            if (last_mode != m_k) {
-                if (_annotation_map.find(m_k) != _annotation_map.end()) {
-                    iter_list = _annotation_map.at(m_k).begin();
-                    iter_list_end = _annotation_map.at(m_k).end();
-                    in_mode_dup = 0;
-                    last_mode = m_k;
-                }
-            }
-            annotation annot_k;
-            if (iter_list != iter_list_end) {
-                annot_k = *(*iter_list).second;
-                in_mode_dup += 1;
-                if (in_mode_dup == (*iter_list).first) {
-                    iter_list++;
-                    in_mode_dup = 0;
-                }
-            }
-            bool merged_photon = false;
-            for (auto &annot_photon: photon_groups) {
-                annotation merge_annot;
-                bool can_merge = annot_photon.first.compatible_annotation(annot_k, merge_annot);
-                if (can_merge) {
-                    annot_photon.first = merge_annot;
-                    annot_photon.second.push_back(k);
-                    merged_photon = true;
-                    break;
-                }
-            }
-            if (!merged_photon) {
-                photon_groups.emplace_back(annot_k, std::list<int>());
-                photon_groups.back().second.push_back(k);
+int fockstate::photons_in_range(int start, int end) const {
+    if (start < 0) start = 0;
+    if (end > _m) end = _m;
+    if (end <= start) return 0;
+    return _first_photon(end)-_first_photon(start);
+}
+
+int fockstate::photon_groups(std::vector<int> &groups) const {
+    groups.assign(_n, 0);
+    if (!_n || !_annotations) return _n ? 1 : 0;
+    /* greedy grouping: each photon joins the first group whose merged annotation is compatible with its own. Group
+     * annotations only gain tags, so that photons sharing an annotation always join the group of the first of them:
+     * the greedy pass only needs to run on the distinct annotations, in order of first occurrence */
+    std::vector<std::pair<annot_id, int>> first_photon(_n);
+    for(int k=0; k<_n; k++)
+        first_photon[k] = std::make_pair((*_annotations)[k], k);
+    std::sort(first_photon.begin(), first_photon.end());
+    first_photon.erase(std::unique(first_photon.begin(), first_photon.end(),
+                                   [](const std::pair<annot_id, int> &a, const std::pair<annot_id, int> &b) {
+                                       return a.first == b.first;
+                                   }), first_photon.end());
+    std::sort(first_photon.begin(), first_photon.end(),
+              [](const std::pair<annot_id, int> &a, const std::pair<annot_id, int> &b) {
+                  return a.second < b.second;
+              });
+    std::vector<annot_id> group_annotations;
+    /* distinct annotations sorted by id, with their group, for the photon lookup */
+    std::vector<std::pair<annot_id, int>> annotation_group;
+    for(auto const &p: first_photon) {
+        int g = 0;
+        int n_groups = int(group_annotations.size());
+        for(; g < n_groups; g++) {
+            annot_id merged;
+            if (annotation_pool::compatible(group_annotations[g], p.first, merged)) {
+                group_annotations[g] = merged;
+                break;
             }
         }
+        if (g == n_groups)
+            group_annotations.push_back(p.first);
+        annotation_group.emplace_back(p.first, g);
+    }
+    std::sort(annotation_group.begin(), annotation_group.end());
+    for(int k=0; k<_n; k++)
+        groups[k] = std::lower_bound(annotation_group.begin(), annotation_group.end(),
+                                     std::make_pair((*_annotations)[k], 0))->second;
+    return int(group_annotations.size());
+}
 
-        if (photon_groups.size() == 1) {
-            states.push_back(*this);
-            states.back().clear_annotations();
+std::list<fockstate> fockstate::separate_state() const {
+    std::list<fockstate> states;
+    std::vector<int> groups;
+    int n_groups = photon_groups(groups);
+    if (n_groups <= 1) {
+        states.push_back(*this);
+        states.back().clear_annotations();
+    } else {
+        /* photons are sorted by mode in each group, the codes of the group states are filled in a single pass */
+        std::vector<int> group_n(n_groups);
+        for(int k=0; k<_n; k++)
+            group_n[groups[k]]++;
+        std::vector<fockstate *> group_states;
+        for(int g=0; g<n_groups; g++) {
+            states.emplace_back(_m, group_n[g]);
+            group_states.push_back(&states.back());
+            group_n[g] = 0;
         }
-        else {
-            // now iterate through photon_groups and generate corresponding non annotated states
-            for(const auto& annot_photon: photon_groups) {
-                std::vector<int> state(_m);
-                for(auto photon_id: annot_photon.second)
-                    state[photon2mode(photon_id)] += 1;
-                states.emplace_back(state);
-            }
+        for(int k=0; k<_n; k++) {
+            int g = groups[k];
+            group_states[g]->_set_mode_at(group_n[g]++, _mode_at(k));
         }
     }
-
     return states;
 }
@@ -25,16 +25,27 @@
 
 #include <vector>
 #include <string>
+#include <cstring>
 #include <stdexcept>
 #include <list>
-#include <unordered_map>
+#include <map>
+#include <memory>
+#include <atomic>
 
 #include "annotation.h"
 
-typedef std::unordered_map<size_t, std::list<std::pair<int, annotation*>>> map_m_lannot;
+/* number of code bytes that are stored directly in the fockstate object - larger states use a heap buffer */
+#define FS_INLINE_CODE 24
+
+/* photon codes use one byte per photon, (unsigned char)(mode+'A'), for up to FS_MAX_M_CODE8 modes and two bytes
+ * per photon (big-endian mode index) above, so that the byte order of the codes is always the lexicographic order
+ * of the states */
+#define FS_MAX_M_CODE8 190
+#define FS_MAX_M 65536
 
 class fockstate {
     friend class fs_array;
+    friend class fs_mask;
 
     public:
         fockstate();
@@ -47,19 +58,58 @@ class fockstate {
         explicit fockstate(const std::vector<int> &fs_vec);
         explicit fockstate(const std::vector<int> &fs_vec, const std::map<int, std::list<std::string>> &annotations);
         fockstate(const fockstate &);
+        fockstate(fockstate &&) noexcept;
         fockstate(int m, int n);
         fockstate(int m, int n, const char *code, bool owned_data=false);
-        fockstate(int m, int n, const char *code, map_m_lannot annots, bool owned_data=false);
         ~fockstate();
         fockstate copy() const;
         unsigned long long hash() const;
         fockstate &operator=(const fockstate &);
+        fockstate &operator=(fockstate &&) noexcept;
 
         /* operations on fockstate */
         /** iterator on fockstates */
         fockstate &operator+=(int);
         fockstate operator+(int) const;
         fockstate &operator++();
+        /**
+         * rank of the state in the lexicographic order followed by operator++, computed in O(m+n)
+         * @return the number of states with m modes and n photons preceding the state
+         */
+        unsigned long long rank() const;
+        /**
+         * state of given rank in the lexicographic order followed by operator++, computed in O(m+n)
+         * @throws std::out_of_range if idx is not lower than `count_states(m, n)`
+         */
+        static fockstate unrank(int m, int n, unsigned long long idx);
+        /** number of states with n photons in m modes: C(m+n-1, n) **/
+        static unsigned long long count_states(int m, int n);
+        /**
+         * bulk construction of the states of a (count, m) row-major array of occupations, in nthreads blocks
+         * @throws std::invalid_argument for negative occupations
+         */
+        static std::vector<fockstate> from_occupations(const int *occupations, size_t count, int m, int nthreads=1);
+        /** bulk parsing of text representations, in nthreads blocks **/
+        static std::vector<fockstate> from_strings(const std::vector<std::string> &strs, int nthreads=1);
+        /**
+         * codes of the states of a (count, m) array of occupations with n photons, packed as in a generated fs_array
+         * of the (m, n) space: count * n * code_width(m) bytes are written in codes
+         * @throws std::invalid_argument for negative occupations or if a state does not have n photons
+         */
+        static void pack_occupations(const int *occupations, size_t count, int m, int n, char *codes,
+                                     int nthreads=1);
+        /**
+         * creation operator on a mode: a†_k|...,n_k,...> = sqrt(n_k+1)|...,n_k+1,...> - the new photon has no annotation
+         * @param amplitude receives sqrt(n_k+1)
+         */
+        fockstate create(int mode, double &amplitude) const;
+        /**
+         * annihilation operator on a mode: a_k|...,n_k,...> = sqrt(n_k)|...,n_k-1,...> - the photon removed is the last
+         * one of the mode, unannotated photons coming last
+         * @param amplitude receives sqrt(n_k)
+         * @return the new state, undefined state if the mode is empty
+         */
+        fockstate annihilate(int mode, double &amplitude) const;
         /** tensor product **/
         fockstate operator*(const fockstate &) const;
         bool operator==(const fockstate &) const;
@@ -70,19 +120,20 @@ class fockstate {
         /** photon_idx to mode **/
         inline int photon2mode(int photon_idx) const {
             if (photon_idx < 0 || photon_idx >= _n) throw std::out_of_range("photon index out of range");
-            return _code[photon_idx]-'A';
+            return _mode_at(photon_idx);
         }
         /** retrieve first photon idx in given mode - or -1 if none **/
         inline int mode2photon(int mode_idx) const {
             if (mode_idx < 0 || mode_idx >= _m) throw std::out_of_range("mode index out of range");
-            int k=0;
-            for(; k < _n && _code[k]-'A' < mode_idx; k++);
-            if (k == _n || _code[k]-'A' != mode_idx) return -1;
-            return k;
+            int p = _first_photon(mode_idx);
+            if (p == _n || _mode_at(p) != mode_idx) return -1;
+            return p;
         }
+        /** number of photons in modes [start, end) **/
+        int photons_in_range(int start, int end) const;
 
         /** annotation specific functions **/
-        bool has_annotations() const { return !_annotation_map.empty(); }
+        bool has_annotations() const { return bool(_annotations); }
         bool has_polarization() const;
         void clear_annotations();
         std::list<annotation> get_mode_annotations(int) const;
@@ -95,6 +146,12 @@ class fockstate {
          * @return list of non annotated fockstates
          */
         std::list<fockstate> separate_state() const;
+        /**
+         * distinguishable groups of photons used by separate_state, computed on interned annotations in O(n log n)
+         * @param groups receives the group of each photon, groups being numbered by order of first photon
+         * @return the number of groups
+         */
+        int photon_groups(std::vector<int> &groups) const;
 
         /** slicing utilities **/
         fockstate slice(int start, int end, int step=1) const;
@@ -109,6 +166,23 @@ class fockstate {
         inline int get_m() const { return _m; }
         inline int get_n() const { return _n; }
         inline const char *get_code() const { return _code; }
+        /** number of bytes coding each photon **/
+        inline int get_code_width() const { return code_width(_m); }
+        /** number of bytes of the photon code **/
+        inline int get_code_size() const { return _n * code_width(_m); }
+        inline static int code_width(int m) { return m > FS_MAX_M_CODE8 ? 2 : 1; }
+        inline static int decode_mode(const char *code, int width, int photon_idx) {
+            if (width == 1) return (unsigned char)code[photon_idx] - 'A';
+            return ((unsigned char)code[2*photon_idx] << 8) | (unsigned char)code[2*photon_idx+1];
+        }
+        inline static void encode_mode(char *code, int width, int photon_idx, int mode) {
+            if (width == 1)
+                code[photon_idx] = char(mode + 'A');
+            else {
+                code[2*photon_idx] = char(mode >> 8);
+                code[2*photon_idx+1] = char(mode & 0xff);
+            }
+        }
         void to_vect(std::vector<int> &) const;
         std::vector<int> to_vect() const;
         inline static unsigned long long hash_function(const char *s, int size=-1) {
@@ -117,6 +191,31 @@ class fockstate {
                 hash = ((hash << 5) + hash) + s[i];
             return hash;
         }
+        /** splitmix64 finalizer - mixes all bits of h **/
+        inline static unsigned long long hash_mix(unsigned long long h) {
+            h ^= h >> 30;
+            h *= 0xbf58476d1ce4e5b9ULL;
+            h ^= h >> 27;
+            h *= 0x94d049bb133111ebULL;
+            h ^= h >> 31;
+            return h;
+        }
+        /** binary hash of a photon code, consuming the code 8 bytes at a time **/
+        inline static unsigned long long hash_code(const char *code, int size, unsigned long long seed=0) {
+            unsigned long long h = hash_mix(seed ^ (0x9e3779b97f4a7c15ULL * (unsigned long long)(size + 1)));
+            int i = 0;
+            for(; i+8 <= size; i+=8) {
+                unsigned long long w;
+                memcpy(&w, code+i, 8);
+                h = hash_mix(h ^ w) + 0x9e3779b97f4a7c15ULL;
+            }
+            if (i < size) {
+                unsigned long long w = 0;
+                memcpy(&w, code+i, size-i);
+                h = hash_mix(h ^ w);
+            }
+            return h;
+        }
         class const_iterator
         {
             public:
@@ -134,12 +233,46 @@ class fockstate {
         const_iterator end() const { return {this, _m}; }
     private:
         void _check_slice(int &start, int &end, int step, int &slice_m, int &slice_n) const;
+        inline int _mode_at(int photon_idx) const { return decode_mode(_code, code_width(_m), photon_idx); }
+        inline void _set_mode_at(int photon_idx, int mode) { encode_mode(_code, code_width(_m), photon_idx, mode); }
+        /* write the code of the state of rank idx in the writable buffer _code */
+        void _unrank_code(unsigned long long idx, unsigned long long total);
+        /* point _code to a writable buffer of n photons in _m modes - inline buffer for small states, heap beyond */
+        char *_alloc_code(int n);
+        void _free_code();
+        void _copy_code(const fockstate &b);
+        /* copy-on-write: make _code a buffer that is not shared with any other state */
+        void _detach_code();
+        inline bool _writable_code() const {
+            return _code == _inline_code || (_shared_code && _shared_code.use_count() == 1);
+        }
+        inline annot_id _annotation_id(int photon_idx) const {
+            return _annotations ? (*_annotations)[photon_idx] : 0;
+        }
+        /* set the photon annotations - a state with only empty annotations does not keep any table */
+        void _set_annotation_ids(std::vector<annot_id> &&ids);
+        /* put the annotations of each mode in canonical order after photons moved to other modes */
+        void _canonical_annotations();
+        /* canonical order of the annotations of the photons of a mode: by annotation string, empty ones last */
+        static void _sort_annotation_ids(annot_id *begin, annot_id *end);
+        /* index of the first photon in mode or above (n if none), by binary search on the sorted code */
+        int _first_photon(int mode) const;
+        /* occupancy table: mode_start[k] = _first_photon(k) for k in [0, m], so that the occupation of mode k is
+         * mode_start[k+1]-mode_start[k] - mode_start is a caller buffer of m+1 entries */
+        void _mode_starts(int *mode_start) const;
         int _m;
         int _n;
+        /* _code points to _inline_code, into _shared_code, to n0_buffer or to external data */
         char *_code;
-        bool _owned_data;
-        /* annotations of photons in different modes */
-        map_m_lannot _annotation_map;
+        /* heap buffer of large states, shared between copies */
+        std::shared_ptr<char> _shared_code;
+        char _inline_code[FS_INLINE_CODE];
+        /* interned annotation of each photon, in canonical order inside each mode - the table is shared between copies
+         * and never modified, nullptr when the state has no annotation */
+        std::shared_ptr<const std::vector<annot_id>> _annotations;
+        /* cached result of hash(), 0 if not computed yet - reset by any modification of the state; atomic since
+         * hash() stores it on const states shared between threads (relaxed: any thread computes the same value) */
+        mutable std::atomic<unsigned long long> _hash{0};
 
         void _parse_str(const char *str);
         void _set_annotations(const std::map<int, std::list<std::string>> &annotations);
@@ -20,51 +20,203 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <fstream>
+#include <list>
+#include <stdexcept>
 #include <filesystem>
 #include <unordered_map>
+#include <vector>
+#include <cmath>
 
 #include "fs_array.h"
+#include "thread_tools.h"
 
 #define DEFAULT_FILENAME "layer-m%d-n%d.fsa"
-#define BUFFER_LENGTH 30
 
-const unsigned long long fs_npos = 0xffffffff;
+/* file format, integers in little-endian:
+ *   0  "FSA"
+ *   3  u8  version
+ *   4  u8  flags: FILE_FLAG_MASKED, FILE_FLAG_COLLISION_FREE
+ *   5  u8  code width
+ *   8  u32 m, 12 u32 n
+ *   16 u64 number of states
+ *   24 u64 checksum of the rest of the file
+ *   32 if masked - u32 mask m, u32 mask n, u32 number of conditions, the conditions of mask m characters, padded to
+ *      8 bytes
+ *   then the codes of the states, as in _buffer */
+#define FILE_FLAG_MASKED 1
+#define FILE_FLAG_COLLISION_FREE 2
 
-void fs_array::_count_fs() {
-    if (_p_mask) {
-        fockstate fs(_m, _n);
-        _count = 0;
-        while(true) {
-            if (_p_mask->match(fs)) _count++;
-            if (!(++fs)._code) break;
-        }
-    } else {
-        _count = 1;
-        for (int nk = 1; nk <= _n; nk++) {
-            _count = (_count * (nk + _m - 1)) / nk;
-        }
+const unsigned long long fs_npos = ~0ULL;
+
+unsigned long long fs_array::implicit_threshold = 1ULL << 30;
+
+/* the mask over the m modes of the array: the conditions of a mask over fewer modes leave the other modes free, as
+ * when matching the states - a mask over more modes cannot require photons in the modes that are not in the array */
+static std::shared_ptr<const fs_mask> fit_mask(const fs_mask &mask, int m) {
+    if (mask.get_m() == m)
+        return std::make_shared<fs_mask>(mask);
+    std::list<std::string> conditions;
+    for (const std::string &c: mask.conditions()) {
+        std::string condition(c);
+        condition.resize(std::min<size_t>(condition.size(), size_t(mask.get_m())));
+        for (size_t i = size_t(m); i < condition.size(); i++)
+            if ((condition[i] > 0x30 && condition[i] < 0x50) || (condition[i] > 0x60 && condition[i] < 0x70))
+                throw std::invalid_argument("mask constrains modes beyond the array modes");
+        condition.resize(size_t(m), ' ');
+        conditions.push_back(condition);
     }
+    return std::make_shared<fs_mask>(m, mask.get_n(), conditions);
+}
+
+void fs_array::_count_fs() {
+    if (_p_mask)
+        _count = _p_mask->count(_n);
+    else if (_collision_free) {
+        _count = _n <= _m;
+        for (int i = 0; i < _n && _count; i++)
+            _count = _count * (_m-i) / (i+1);
+    } else
+        _count = fockstate::count_states(_m, _n);
 }
 
-fs_array::fs_array(int m, int n): _buffer(nullptr), _m(m), _n(n), _count(0), _p_mask(nullptr) {
+fs_array::fs_array(int m, int n): _buffer(nullptr), _m(m), _n(n), _count(0), _p_mask(nullptr),
+                                  _collision_free(false), _implicit(false) {
     _count_fs();
+    _implicit = size() > implicit_threshold;
+}
+
+fs_array::fs_array(int m, int n, bool collision_free): _buffer(nullptr), _m(m), _n(n), _count(0), _p_mask(nullptr),
+                                                       _collision_free(collision_free), _implicit(false) {
+    _count_fs();
+    _implicit = size() > implicit_threshold;
+    /* every access of a collision-free array goes through the table, that is shared by the generation threads */
+    if (_collision_free)
+        _build_rank_table();
 }
 
 fs_array::fs_array(int m, int n, const fs_mask &mask): _buffer(nullptr),
                                                        _m(m),
                                                        _n(n),
                                                        _count(0),
-                                                       _p_mask(new fs_mask(mask)) {
+                                                       _p_mask(fit_mask(mask, m)),
+                                                       _collision_free(false),
+                                                       _implicit(false) {
     _count_fs();
 }
 
-const unsigned char fs_array::version = 2;
+const unsigned char fs_array::version = 3;
+
+fs_array::fs_array(const std::string &path, int m, int n, bool verify): _buffer(nullptr), _m(m), _n(n), _count(0),
+                                                                        _collision_free(false), _implicit(false) {
+    std::string filename = resolve_file_path(path, DEFAULT_FILENAME, m, n);
+    std::shared_ptr<mapped_file> mapping = std::make_shared<mapped_file>(filename);
+    const char *data = mapping->data();
+    size_t file_size = mapping->size();
+    if (file_size < FILE_HEADER_SIZE || memcmp(data, "FSA", 3) != 0)
+        throw std::runtime_error("not a fs_array file: "+filename);
+    if ((unsigned char)data[3] != version)
+        throw std::runtime_error("unsupported fs_array file version: "+filename);
+    if (get_le(data+8, 4) != (unsigned long long)m || get_le(data+12, 4) != (unsigned long long)n)
+        throw std::invalid_argument("incompatible m/n in fs_array file: "+filename);
+    int flags = data[4];
+    if (data[5] != fockstate::code_width(m))
+        throw std::runtime_error("corrupted fs_array file: "+filename);
+    _collision_free = (flags & FILE_FLAG_COLLISION_FREE) != 0;
+    size_t offset = FILE_HEADER_SIZE;
+    if (flags & FILE_FLAG_MASKED) {
+        if (file_size < offset+12)
+            throw std::runtime_error("corrupted fs_array file: "+filename);
+        int mask_m = int(get_le(data+offset, 4));
+        int mask_n = int(get_le(data+offset+4, 4));
+        size_t conditions_count = size_t(get_le(data+offset+8, 4));
+        offset += 12;
+        if (mask_m < 0 || (file_size-offset)/(size_t(mask_m)+1) < conditions_count)
+            throw std::runtime_error("corrupted fs_array file: "+filename);
+        std::list<std::string> conditions;
+        for (size_t c = 0; c < conditions_count; c++, offset += mask_m)
+            conditions.emplace_back(data+offset, mask_m);
+        offset = (offset+7) & ~size_t(7);
+        _p_mask = fit_mask(fs_mask(mask_m, mask_n, conditions), m);
+    }
+    _count_fs();
+    if (get_le(data+16, 8) != _count || offset > file_size || file_size-offset != size())
+        throw std::runtime_error("corrupted fs_array file: "+filename);
+    if (verify && file_checksum(data+FILE_HEADER_SIZE, file_size-FILE_HEADER_SIZE) != get_le(data+24, 8))
+        throw std::runtime_error("checksum mismatch in fs_array file: "+filename);
+    _mapping = mapping;
+    _buffer = const_cast<char *>(data+offset);
+    if (_collision_free)
+        _build_rank_table();
+}
 
 fs_array::~fs_array() {
-    delete [] _buffer;
+    /* a mapped buffer is released with the mapping */
+    if (!_mapping)
+        delete [] _buffer;
+}
+
+int fs_array::_file_flags() const {
+    return (_p_mask ? FILE_FLAG_MASKED : 0) | (_collision_free ? FILE_FLAG_COLLISION_FREE : 0);
+}
+
+std::vector<char> fs_array::_mask_description() const {
+    std::vector<char> description;
+    if (!_p_mask)
+        return description;
+    int mask_m = _p_mask->get_m();
+    description.resize(12, 0);
+    put_le(description.data(), mask_m, 4);
+    put_le(description.data()+4, _p_mask->get_n(), 4);
+    put_le(description.data()+8, _p_mask->conditions().size(), 4);
+    for (const std::string &c: _p_mask->conditions()) {
+        std::string condition(c);
+        condition.resize(mask_m, ' ');
+        description.insert(description.end(), condition.begin(), condition.end());
+    }
+    description.resize((description.size()+7) & ~size_t(7), 0);
+    return description;
+}
+
+void fs_array::save(const std::string &path) const {
+    generate();
+    std::string filename = resolve_file_path(path, DEFAULT_FILENAME, _m, _n);
+    std::vector<char> header(FILE_HEADER_SIZE, 0);
+    memcpy(header.data(), "FSA", 3);
+    header[3] = char(version);
+    header[4] = char(_file_flags());
+    header[5] = char(fockstate::code_width(_m));
+    put_le(header.data()+8, _m, 4);
+    put_le(header.data()+12, _n, 4);
+    put_le(header.data()+16, _count, 8);
+    std::vector<char> description = _mask_description();
+    header.insert(header.end(), description.begin(), description.end());
+    /* the file is written aside and then replaces the previous one, which may be mapped by other processes */
+    std::string tmp_filename = filename+".tmp";
+    std::ofstream f(tmp_filename, std::ios::binary | std::ios::trunc);
+    if (!f)
+        throw std::runtime_error("cannot write file "+filename);
+    f.write(header.data(), std::streamsize(header.size()));
+    /* the codes of implicit arrays are streamed, the checksum is written once they are all known */
+    unsigned long long checksum = file_checksum(header.data()+FILE_HEADER_SIZE, header.size()-FILE_HEADER_SIZE);
+    int state_size = _state_size();
+    _for_each_chunk(0, _count, [&](unsigned long long, unsigned long long count, const char *codes) {
+        checksum = file_checksum(codes, count*state_size, checksum);
+        f.write(codes, std::streamsize(count*state_size));
+    });
+    put_le(header.data()+24, checksum, 8);
+    f.seekp(24);
+    f.write(header.data()+24, 8);
+    f.close();
+    if (!f) {
+        std::remove(tmp_filename.c_str());
+        throw std::runtime_error("cannot write file "+filename);
+    }
+    replace_file(tmp_filename, filename);
 }
 
 unsigned long long fs_array::count() const {
@@ -72,23 +224,118 @@ unsigned long long fs_array::count() const {
 }
 
 unsigned long long fs_array::size() const {
-    return _count*_n;
+    return _count*_state_size();
+}
+
+void fs_array::_fill_range(unsigned long long rank_start, unsigned long long rank_end, char *dest) const {
+    if (rank_start >= rank_end)
+        return;
+    int state_size = _state_size();
+    if (_collision_free) {
+        _unrank_collision_free(rank_start, dest);
+        for (unsigned long long rank = rank_start+1; rank < rank_end; rank++, dest += state_size) {
+            memcpy(dest+state_size, dest, state_size);
+            _next_collision_free(dest+state_size);
+        }
+        return;
+    }
+    fockstate fs = fockstate::unrank(_m, _n, rank_start);
+    for (unsigned long long rank = rank_start; ; dest += state_size) {
+        memcpy(dest, fs._code, state_size);
+        if (++rank == rank_end) break;
+        ++fs;
+    }
+}
+
+/* number of states unranked at once when iterating an implicit array */
+#define IMPLICIT_CHUNK 4096
+
+void fs_array::_for_each_chunk(unsigned long long start, unsigned long long end,
+                               const std::function<void(unsigned long long, unsigned long long, const char *)> &f) const {
+    if (start >= end)
+        return;
+    if (_buffer) {
+        f(start, end-start, _buffer+start*_state_size());
+        return;
+    }
+    std::vector<char> chunk(IMPLICIT_CHUNK*size_t(_state_size())+1);
+    for (unsigned long long first = start; first < end; first += IMPLICIT_CHUNK) {
+        unsigned long long last = std::min<unsigned long long>(end, first+IMPLICIT_CHUNK);
+        _fill_range(first, last, chunk.data());
+        f(first, last-first, chunk.data());
+    }
 }
 
-void fs_array::generate() const {
-    if (_buffer)
+void fs_array::_generate_masked(char *buffer, int nthreads) const {
+    int state_size = _state_size();
+    /* split the enumeration on the occupations of the first modes, until there are enough tasks to balance the
+     * threads - the prefixes are in lexicographic order so that their states are contiguous in the buffer */
+    std::vector<std::vector<int>> prefixes(1);
+    for (int depth = 0; depth < _m-1 && nthreads > 1 && prefixes.size() < 8*size_t(nthreads); depth++) {
+        std::vector<std::vector<int>> next;
+        for (const auto &prefix: prefixes) {
+            int used = 0;
+            for (int v: prefix) used += v;
+            for (int v = _n-used; v >= 0; v--) {
+                next.push_back(prefix);
+                next.back().push_back(v);
+            }
+        }
+        prefixes.swap(next);
+    }
+    if (prefixes.size() == 1) {
+        _p_mask->enumerate(_n, prefixes[0], [&buffer, state_size](const char *code) {
+            memcpy(buffer, code, state_size);
+            buffer += state_size;
+        });
         return;
-    _buffer = new char[size()==0?1:size()];
-    fockstate fs(_m, _n);
-    unsigned long long idx=0;
-    while(true) {
-        int i;
-        if (!_p_mask || _p_mask->match(fs)) {
-            for(i=0;i<_n;i++) _buffer[i+idx] = fs._code[i];
-            idx += _n;
+    }
+    /* a first pass counts the states of each prefix to get its offset in the buffer */
+    std::vector<unsigned long long> offset(prefixes.size()+1, 0);
+    run_blocks(prefixes.size(), nthreads, [&](size_t start, size_t end) {
+        for (size_t t = start; t < end; t++) {
+            unsigned long long count = 0;
+            _p_mask->enumerate(_n, prefixes[t], [&count](const char *) { count++; });
+            offset[t+1] = count;
         }
-        if (!(++fs)._code) break;
+    });
+    for (size_t t = 0; t < prefixes.size(); t++)
+        offset[t+1] += offset[t];
+    run_blocks(prefixes.size(), nthreads, [&](size_t start, size_t end) {
+        for (size_t t = start; t < end; t++) {
+            char *dest = buffer + offset[t]*state_size;
+            _p_mask->enumerate(_n, prefixes[t], [&dest, state_size](const char *code) {
+                memcpy(dest, code, state_size);
+                dest += state_size;
+            });
+        }
+    });
+}
+
+void fs_array::generate(int nthreads) const {
+    if (_buffer || _implicit)
+        return;
+    char *buffer = new char[size()==0?1:size()];
+    if (nthreads == 0)
+        nthreads = std::thread::hardware_concurrency();
+    if (_p_mask) {
+        _generate_masked(buffer, nthreads);
+        _buffer = buffer;
+        return;
     }
+    unsigned long long total = _count;
+    /* the space is split in contiguous ranges of ranks, each starting from its unranked first state */
+    size_t nblocks = nthreads > 1 ? size_t(nthreads) : 1;
+    if (nblocks > total) nblocks = total ? size_t(total) : 1;
+    std::vector<unsigned long long> rank_start(nblocks+1);
+    for (size_t b = 0; b <= nblocks; b++)
+        rank_start[b] = total / nblocks * b + std::min<unsigned long long>(b, total % nblocks);
+    int state_size = _state_size();
+    run_blocks(nblocks, nthreads, [&](size_t start, size_t end) {
+        for (size_t b = start; b < end; b++)
+            _fill_range(rank_start[b], rank_start[b+1], buffer+rank_start[b]*state_size);
+    });
+    _buffer = buffer;
 }
 
 fs_array::const_iterator fs_array::find(const fockstate &fs) const {
@@ -97,44 +344,137 @@ fs_array::const_iterator fs_array::find(const fockstate &fs) const {
     return {this, idx};
 }
 
-unsigned long long fs_array::find_idx(const fockstate &fs) const {
+void fs_array::_prepare_find() const {
+    if (!_p_mask) {
+        _build_rank_table();
+        return;
+    }
     generate();
+    if (!_prefix_start.empty()) return;
+    /* states are sorted by code, so that the states with a given first photon mode are contiguous */
+    std::vector<unsigned long long> prefix_start(_m+1);
+    int width = fockstate::code_width(_m);
+    int state_size = _state_size();
+    unsigned long long idx = 0;
+    for (int c = 0; c <= _m; c++) {
+        while (_n && idx < _count && fockstate::decode_mode(_buffer+idx*state_size, width, 0) < c) idx++;
+        prefix_start[c] = idx;
+    }
+    _prefix_start.swap(prefix_start);
+}
+
+void fs_array::_build_rank_table() const {
+    if (!_rank_table.empty()) return;
+    int stride = _n+1;
+    std::vector<unsigned long long> table(size_t(_m+1)*stride);
+    /* Pascal rule: C(x+b-1, b) = C(x+b-2, b) + C(x+b-2, b-1), and C(x, b) = C(x-1, b) + C(x-1, b-1) */
+    for (int x = 0; x <= _m; x++)
+        for (int b = 0; b <= _n; b++) {
+            if (b == 0) table[x*stride] = 1;
+            else if (x == 0) table[b] = 0;
+            else if (_collision_free) table[x*stride+b] = table[(x-1)*stride+b] + table[(x-1)*stride+b-1];
+            else table[x*stride+b] = table[(x-1)*stride+b] + table[x*stride+b-1];
+        }
+    _rank_table.swap(table);
+}
+
+unsigned long long fs_array::_rank_code(const char *code) const {
+    _build_rank_table();
+    int width = fockstate::code_width(_m);
+    int stride = _n+1;
+    unsigned long long sum = 0;
+    int lowest = 0;
+    for (int p = 0; p < _n; p++) {
+        int c = fockstate::decode_mode(code, width, p);
+        /* not a code of the space */
+        if (c < lowest || c >= _m) return fs_npos;
+        sum += _rank_table[(_m-1-c)*stride + _n-p];
+        lowest = _collision_free ? c+1 : c;
+    }
+    return _rank_table[_m*stride+_n]-1-sum;
+}
+
+void fs_array::_unrank_collision_free(unsigned long long idx, char *code) const {
+    _build_rank_table();
+    int width = fockstate::code_width(_m);
+    int stride = _n+1;
+    unsigned long long remain = _rank_table[_m*stride+_n]-1-idx;
+    /* greedy decomposition of remain = sum_p C(x_p, n-p) with x_0 > x_1 > ... */
+    int x = _m;
+    for (int p = 0; p < _n; p++) {
+        for (x--; _rank_table[x*stride+_n-p] > remain; x--);
+        remain -= _rank_table[x*stride+_n-p];
+        fockstate::encode_mode(code, width, p, _m-1-x);
+    }
+}
+
+bool fs_array::_next_collision_free(char *code) const {
+    int width = fockstate::code_width(_m);
+    /* last photon that can still move up, the following ones are packed right after it */
+    int p = _n-1;
+    while (p >= 0 && fockstate::decode_mode(code, width, p) == _m-_n+p) p--;
+    if (p < 0)
+        return false;
+    int c = fockstate::decode_mode(code, width, p);
+    for (int q = p; q < _n; q++)
+        fockstate::encode_mode(code, width, q, ++c);
+    return true;
+}
+
+unsigned long long fs_array::find_idx(const fockstate &fs) const {
     if (fs.get_m() != _m)
         throw std::invalid_argument("incorrect fock state");
     // empty state
     if (!_n) {
-        if (fs.get_n() == 0)
+        if (fs.get_n() == 0 && _count)
             return 0;
         else
             return fs_npos;
     }
-    if (fs.get_n() != _n)
+    if (fs.get_n() != _n || !fs._code)
         return fs_npos;
-    // binary search -> O(log_2 _count)
-    char *code = fs._code;
-    unsigned long long begin_range = 0;
-    unsigned long long end_range = _count;
-    unsigned long long middle;
-    unsigned long long last_tested_idx = fs_npos;
-    while ((end_range-begin_range)>1) {
-        middle = (begin_range+end_range)>>1;
-        int comparator = strncmp(code, _buffer+_n*middle, _n);
+    return find_code_idx(fs._code);
+}
+
+unsigned long long fs_array::find_code_idx(const char *code) const {
+    /* without mask, the index is the rank of the code -> O(n), no buffer needed */
+    if (!_p_mask)
+        return _n ? _rank_code(code) : 0;
+    _prepare_find();
+    if (!_count)
+        return fs_npos;
+    if (!_n)
+        return 0;
+    // binary search in the range of the states with the same first photon mode
+    int first_mode = fockstate::decode_mode(code, fockstate::code_width(_m), 0);
+    if (first_mode < 0 || first_mode >= _m)
+        return fs_npos;
+    int state_size = _state_size();
+    unsigned long long begin_range = _prefix_start[first_mode];
+    unsigned long long end_range = _prefix_start[first_mode+1];
+    while (begin_range < end_range) {
+        unsigned long long middle = (begin_range+end_range)>>1;
+        int comparator = memcmp(code, _buffer+state_size*middle, state_size);
         if (comparator == 0) return middle;
-        last_tested_idx = middle;
         if (comparator < 0) end_range = middle;
-        else begin_range = middle;
+        else begin_range = middle+1;
     }
-    middle = (begin_range+end_range)>>1;
-    if (last_tested_idx != middle && strncmp(code, _buffer+_n*middle, _n) == 0)
-        return middle;
     return fs_npos;
 }
 
 fockstate fs_array::operator[](unsigned long long idx) const {
     if (idx>=_count)
         throw std::out_of_range("index too large");
+    /* without mask, the state is directly computed from its rank */
+    if (!_buffer && _collision_free) {
+        fockstate fs(_m, _n);
+        _unrank_collision_free(idx, fs._code);
+        return fs;
+    }
+    if (!_buffer && !_p_mask)
+        return fockstate::unrank(_m, _n, idx);
     generate();
-    return {_m, _n, _buffer+idx*_n};
+    return {_m, _n, _buffer+idx*_state_size()};
 }
 
 fs_array::const_iterator::const_iterator(const fs_array *fsa, bool first):_fsa(fsa),_pfs(nullptr) {
@@ -145,6 +485,8 @@ fs_array::const_iterator::const_iterator(const fs_array *fsa, bool first):_fsa(f
     /* if fsa is not generated - just go through the different states */
     if (!fsa->_buffer) {
         _pfs = new fockstate(fsa->_m, fsa->_n);
+        if (fsa->_collision_free && fsa->_count)
+            fsa->_unrank_collision_free(0, _pfs->_code);
         _find_next();
     }
 }
@@ -153,6 +495,14 @@ fs_array::const_iterator::const_iterator(const fs_array *fsa, unsigned long long
                                                                                         _pfs(nullptr),
                                                                                         idx(f_idx) {
     if (!fsa->_buffer) {
+        if (!fsa->_p_mask) {
+            _pfs = new fockstate(fsa->_m, fsa->_n);
+            if (f_idx >= fsa->_count)
+                _pfs->_free_code();
+            else
+                *_pfs = (*fsa)[f_idx];
+            return;
+        }
         _pfs = new fockstate(fsa->_m, fsa->_n);
         _find_next();
         while(f_idx && _pfs->_code) {
@@ -212,7 +562,15 @@ void fs_array::const_iterator::_find_next() {
 fs_array::const_iterator::self_type &fs_array::const_iterator::operator++() {
     if (idx<_fsa->_count) {
         ++idx;
-        if (_pfs) { ++(*_pfs); _find_next(); }
+        if (_pfs && _fsa->_collision_free) {
+            _pfs->_detach_code();
+            _pfs->_hash.store(0, std::memory_order_relaxed);
+            if (!_fsa->_next_collision_free(_pfs->_code))
+                _pfs->_free_code();
+        } else if (_pfs) {
+            ++(*_pfs);
+            _find_next();
+        }
     }
     return *this;
 }
@@ -220,7 +578,7 @@ fs_array::const_iterator::self_type &fs_array::const_iterator::operator++() {
 fockstate fs_array::const_iterator::operator*() {
     if (_pfs)
         return _pfs->copy();
-    return {_fsa->_m, _fsa->_n, _fsa->_buffer+idx*_fsa->_n, false};
+    return {_fsa->_m, _fsa->_n, _fsa->_buffer+idx*_fsa->_state_size(), false};
 }
 
 bool fs_array::const_iterator::operator==(const fs_array::const_iterator::self_type& rhs) const {
@@ -233,23 +591,103 @@ bool fs_array::const_iterator::operator!=(const fs_array::const_iterator::self_t
 
 void fs_array::norm_coefs(std::complex<double> *p_coefs) const {
     generate();
-    const char *_code = _buffer;
+    int state_size = _state_size();
     std::unordered_map<unsigned long, double> sqrt_o;
-    for(unsigned long i=0; i < count(); i++, _code+=_n) {
-        unsigned long p = 1;
-        for(int j=0; j<_n;) {
-            int k=1;
-            while (j+k<_n && _code[j+k] == _code[j])
-                p *= ++k;
-            j += k;
+    _for_each_chunk(0, _count, [&](unsigned long long first, unsigned long long count, const char *codes) {
+        for (unsigned long long i = first; i < first+count; i++, codes += state_size) {
+            unsigned long p = fockstate(_m, _n, codes).prodnfact();
+            auto it = sqrt_o.find(p);
+            double coef;
+            if (it == sqrt_o.end()) {
+                coef = sqrt((double) p);
+                sqrt_o[p] = coef;
+            } else
+                coef = it->second;
+            p_coefs[i] *= coef;
         }
-        auto it = sqrt_o.find(p);
-        double coef;
-        if (it == sqrt_o.end()) {
-            coef = sqrt((double) p);
-            sqrt_o[p] = coef;
-        } else
-            coef = it->second;
-        p_coefs[i] *= coef;
-    }
+    });
+}
+
+void fs_array::create_map(const fs_array &target, unsigned long long *idx, double *amplitude, int nthreads) const {
+    _operator_map(target, 1, idx, amplitude, nthreads);
+}
+
+void fs_array::annihilate_map(const fs_array &target, unsigned long long *idx, double *amplitude,
+                              int nthreads) const {
+    _operator_map(target, -1, idx, amplitude, nthreads);
+}
+
+void fs_array::_operator_map(const fs_array &target, int delta, unsigned long long *idx, double *amplitude,
+                             int nthreads) const {
+    if (target._m != _m || target._n != _n+delta)
+        throw std::invalid_argument("incompatible target layer");
+    /* buffers and tables are built before the threads are started - implicit sources are unranked by each thread */
+    generate();
+    if (!_p_mask)
+        _build_rank_table();
+    target._prepare_find();
+    int width = fockstate::code_width(_m);
+    int state_size = _state_size();
+    run_blocks(_count, nthreads, [&](size_t start, size_t end) {
+        std::vector<char> new_code(target._state_size()+1);
+        _for_each_chunk(start, end, [&](unsigned long long chunk_start, unsigned long long count, const char *codes) {
+            for (unsigned long long i = chunk_start; i < chunk_start+count; i++, codes += state_size) {
+                const char *code = codes;
+                /* photons of mode k are [first, last) - the photons are sorted so that the range only moves forward */
+                int first = 0;
+                for (int k = 0; k < _m; k++) {
+                    int last = first;
+                    while (last < _n && fockstate::decode_mode(code, width, last) == k) last++;
+                    size_t o = i*_m + k;
+                    if (delta > 0) {
+                        memcpy(new_code.data(), code, last*width);
+                        fockstate::encode_mode(new_code.data(), width, last, k);
+                        memcpy(new_code.data()+(last+1)*width, code+last*width, (_n-last)*width);
+                        idx[o] = target.find_code_idx(new_code.data());
+                        if (amplitude) amplitude[o] = sqrt(double(last-first+1));
+                    } else if (last == first) {
+                        idx[o] = fs_npos;
+                        if (amplitude) amplitude[o] = 0;
+                    } else {
+                        memcpy(new_code.data(), code, (last-1)*width);
+                        memcpy(new_code.data()+(last-1)*width, code+last*width, (_n-last)*width);
+                        idx[o] = target.find_code_idx(new_code.data());
+                        if (amplitude) amplitude[o] = sqrt(double(last-first));
+                    }
+                    first = last;
+                }
+            }
+        });
+    });
+}
+
+void fs_array::find_many(const char *codes, size_t count, unsigned long long *idx, int nthreads) const {
+    _prepare_find();
+    int state_size = _state_size();
+    run_blocks(count, nthreads, [&](size_t start, size_t end) {
+        for (size_t i = start; i < end; i++)
+            idx[i] = find_code_idx(codes + i*state_size);
+    });
+}
+
+void fs_array::find_many(const int *occupations, size_t count, unsigned long long *idx, int nthreads) const {
+    _prepare_find();
+    int width = fockstate::code_width(_m);
+    run_blocks(count, nthreads, [&](size_t start, size_t end) {
+        std::vector<char> code(_state_size()+1);
+        for (size_t i = start; i < end; i++) {
+            const int *row = occupations + i*_m;
+            int k = 0;
+            bool valid = true;
+            for (int mode = 0; valid && mode < _m; mode++) {
+                if (row[mode] < 0 || row[mode] > _n-k) {
+                    valid = false;
+                    break;
+                }
+                for (int j = 0; j < row[mode]; j++)
+                    fockstate::encode_mode(code.data(), width, k++, mode);
+            }
+            idx[i] = valid && k == _n ? find_code_idx(code.data()) : fs_npos;
+        }
+    });
 }
@@ -25,8 +25,13 @@
 
 #include <cstring>
 #include <complex>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "fockstate.h"
+#include "file_tools.h"
 #include "fs_mask.h"
 #include "memory_tools.h"
 
@@ -39,14 +44,46 @@ class fs_array {
     friend class fs_map;
     public:
         static const unsigned char version;
+        /**
+         * unmasked and collision-free arrays whose buffer would be larger than implicit_threshold bytes are implicit:
+         * they are never generated, states are unranked and ranked on the fly - default is 1GB
+         */
+        static unsigned long long implicit_threshold;
         fs_array(int m, int n);
         fs_array(int m, int n, const fs_mask &mask);
+        /**
+         * array of the collision-free states (at most one photon per mode) if collision_free - C(m,n) states,
+         * ranked and unranked directly
+         */
+        fs_array(int m, int n, bool collision_free);
+        /**
+         * load an array saved with save(), memory-mapped read-only so that large arrays are available immediately
+         * and shared between processes through the page cache
+         * @param path the file, or the directory containing the file with the default name for (m, n)
+         * @param verify check the checksum of the file - reads the whole file, so that it is off by default to keep the
+         *        loading immediate
+         * @throws std::invalid_argument if the file is not a (m, n) array
+         * @throws std::runtime_error if the file cannot be read, has an unknown version or is corrupted
+         */
+        fs_array(const std::string &path, int m, int n, bool verify=false);
         ~fs_array();
         unsigned long long count() const;
         unsigned long long size() const;
         inline int get_m() const { return this->_m; }
         inline int get_n() const { return this->_n; }
-        void generate() const;
+        inline bool is_collision_free() const { return this->_collision_free; }
+        inline bool is_implicit() const { return this->_implicit; }
+        /**
+         * build the buffer of the state codes, filling contiguous ranges of states in nthreads threads
+         * (0 for all available cores) - does nothing for implicit arrays
+         */
+        void generate(int nthreads=1) const;
+        /**
+         * save the generated array, its mask and a checksum in a versioned binary file (format in fs_array.cpp)
+         * @param path the file, or a directory where the file is saved under the default name for (m, n)
+         * @throws std::runtime_error if the file cannot be written
+         */
+        void save(const std::string &path) const;
         fockstate operator[](unsigned long long) const;
         class const_iterator
         {
@@ -82,16 +119,90 @@ class fs_array {
          * @return the idx of the fockstate or npos if not found
          */
         unsigned long long find_idx(const fockstate &fs_vec) const;
+        /**
+         * find index of a state given its photon code, e.g. produced by `fockstate::pack_occupations`
+         * @param code the n * code_width(m) bytes of the code
+         * @return the idx of the fockstate or npos if not found
+         */
+        unsigned long long find_code_idx(const char *code) const;
+        /**
+         * find the indexes of a batch of states, in nthreads blocks
+         * @param codes count packed codes of n * code_width(m) bytes, as produced by `fockstate::pack_occupations`
+         * @param idx receives the count indexes, npos for states not found
+         */
+        void find_many(const char *codes, size_t count, unsigned long long *idx, int nthreads=1) const;
+        /**
+         * find the indexes of the states of a (count, m) row-major array of occupations, in nthreads blocks
+         * @param idx receives the count indexes, npos for states not found
+         */
+        void find_many(const int *occupations, size_t count, unsigned long long *idx, int nthreads=1) const;
         const_iterator begin() const { return {this, true}; }
         const_iterator end() const { return {this, false}; }
         void norm_coefs(std::complex<double> *p_coefs) const;
+        /**
+         * index map of the creation operators into a (m, n+1) layer: for the state of index i and the mode k,
+         * idx[i*m+k] is the index in target of a†_k applied on the state (npos if not in target) and
+         * amplitude[i*m+k] = sqrt(n_k+1)
+         * @param amplitude can be nullptr if not needed
+         */
+        void create_map(const fs_array &target, unsigned long long *idx, double *amplitude, int nthreads=1) const;
+        /**
+         * index map of the annihilation operators into a (m, n-1) layer, same layout as create_map - idx is npos
+         * and amplitude is 0 for empty modes
+         */
+        void annihilate_map(const fs_array &target, unsigned long long *idx, double *amplitude, int nthreads=1) const;
     private:
         void _count_fs();
+        /* copy the codes of the states of ranks [rank_start, rank_end) of an unmasked array into dest */
+        void _fill_range(unsigned long long rank_start, unsigned long long rank_end, char *dest) const;
+        /* call f(first, count, codes) on consecutive chunks of the codes of the states [start, end), read from _buffer
+         * or unranked in a temporary chunk for implicit arrays - generate() must have been called, and _rank_table
+         * built before concurrent calls */
+        void _for_each_chunk(unsigned long long start, unsigned long long end,
+                             const std::function<void(unsigned long long, unsigned long long, const char *)> &f) const;
+        /* fill buffer with the states matching the mask, enumerated in parallel on the occupations of the first
+         * modes */
+        void _generate_masked(char *buffer, int nthreads) const;
+        /* common implementation of create_map (delta=1) and annihilate_map (delta=-1) */
+        void _operator_map(const fs_array &target, int delta, unsigned long long *idx, double *amplitude,
+                           int nthreads) const;
+        /* number of bytes of the code of each state in _buffer */
+        inline int _state_size() const { return _n * fockstate::code_width(_m); }
+        /* rank of a code in the unmasked (m,n) space, in O(n) with _rank_table */
+        unsigned long long _rank_code(const char *code) const;
+        /* write in code the collision-free state of rank idx */
+        void _unrank_collision_free(unsigned long long idx, char *code) const;
+        /* move code to the next collision-free state, false if it was the last one */
+        bool _next_collision_free(char *code) const;
+        /* build _rank_table if needed */
+        void _build_rank_table() const;
+        /* FILE_FLAG_* flags of the array in the files (see fs_array.cpp) */
+        int _file_flags() const;
+        /* mask of the array as stored in the files after the fixed header, empty if not masked */
+        std::vector<char> _mask_description() const;
+        /* build the structures used by find_code_idx - not thread-safe, to call before any parallel lookup */
+        void _prepare_find() const;
         mutable char *_buffer;
         int _m;
         int _n;
         unsigned long long _count;
-        const fs_mask *_p_mask;
+        std::shared_ptr<const fs_mask> _p_mask;
+        /* only the states with at most one photon per mode */
+        bool _collision_free;
+        /* no buffer, see implicit_threshold */
+        bool _implicit;
+        /* for unmasked arrays, _rank_table[x*(n+1)+b] = C(x+b-1, b) for x in [0,m] and b in [0,n], built lazily
+         * (by the constructor for collision-free arrays, so that it is never built concurrently):
+         * the rank of a code c_0 <= ... <= c_(n-1) is C(m+n-1, n) - 1 - sum_p C(x_p+b_p-1, b_p) with
+         * x_p = m-1-c_p and b_p = n-p, see fockstate::rank
+         * for collision-free arrays, _rank_table[x*(n+1)+b] = C(x, b): the rank of a code c_0 < ... < c_(n-1) is
+         * C(m, n) - 1 - sum_p C(x_p, b_p) (combinatorial number system on the x_p) */
+        mutable std::vector<unsigned long long> _rank_table;
+        /* for masked arrays, _prefix_start[c] is the index of the first state of _buffer with its first photon in mode
+         * c or above, (m+1 entries) - built lazily by _prepare_find */
+        mutable std::vector<unsigned long long> _prefix_start;
+        /* file mapped by the loading constructor, _buffer then points into it */
+        std::shared_ptr<mapped_file> _mapping;
 };
 
 #endif
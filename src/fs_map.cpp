@@ -21,33 +21,30 @@
 // SOFTWARE.
 
 #include <cassert>
+#include <cstdio>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
-#include <unordered_map>
+#include <stdexcept>
+#include <vector>
 
 #include "fs_map.h"
 #include "fockstate.h"
 
-struct NStrHash {
-    int _size;
-    explicit NStrHash(int size):_size(size) {}
-    unsigned long long operator()(const char *s) const {
-        return fockstate::hash_function(s, _size);
-    }
-};
-
-struct NStrCompare {
-    int _size;
-    explicit NStrCompare(int size):_size(size) {}
-    bool operator()(const char *s1, const char *s2) const {
-        return memcmp(s1, s2, _size) == 0;
-    }
-};
+#define DEFAULT_FILENAME "map-m%d-n%d.fsm"
 
-typedef std::unordered_map<const char*, unsigned long long, NStrHash, NStrCompare> NStrUMap;
+/* file format, integers in little-endian:
+ *   0  "FSM"
+ *   3  u8  version
+ *   4  u8  number of bytes of each index (step)
+ *   5  u8  flags of the parent layer, 6 u8 flags of the current layer - as in the fs_array files
+ *   8  u32 m, 12 u32 n (parent layer)
+ *   16 u64 number of parent states
+ *   24 u64 checksum of the rest of the file
+ *   32 the masks of the parent and current layers if masked, as in the fs_array files
+ *   then the map, as in _buffer */
 
-unsigned char fs_map::version = 1;
+unsigned char fs_map::version = 3;
 
 /* given layer nk generate map between nk-1 and nk */
 fs_map::fs_map(const fs_array &fsa_current, const fs_array &fsa_parent, bool do_generate):_buffer(nullptr),
@@ -75,51 +72,134 @@ void fs_map::generate() const {
      * between parent fsa and current fsa when adding the additional photon in mode m */
     _buffer = new unsigned char[size()];
     ::memset(_buffer, 0xff, size());
-    NStrUMap index_current_level(0, NStrHash(_n), NStrCompare(_n));
-    index_current_level.reserve(2*_count);
-    unsigned long long idx = 0;
-    /* fsa array for level n (parent fsa) can be directly obtained from current fsa array - just skipping first photon
-     * index current level is the address of parent state in parent fsa */
-    for(fockstate fs: *_pfsa_parent) {
-        index_current_level[fs.get_code()] = idx;
-        idx++;
-    }
-    const char *state_nk = _pfsa_current->_buffer;
-    char *fs_temp=new char[_n];
+    /* codes of parent states have _n photons of width bytes each */
+    int width = fockstate::code_width(_m);
+    int parent_size = _n*width;
+    int state_size = nk*width;
+    char *fs_temp=new char[parent_size ? parent_size : 1];
     /* simply go through the current state, and build all the possible parent states, get their index
-     * and save them in the "map" */
-    for(unsigned long long k=0; k<_pfsa_current->_count; k++, state_nk+=nk) {
-        /* starting from state_k[i*nk] => builds the fock_state-1 with one photon less */
-        int prev_i = 0;
-        for(int i=0; i<nk; i++) {
-            if (i<_n && state_nk[i+1] == state_nk[i])
-                continue;
-            for(int h=prev_i;h<i;h++)
-                fs_temp[h] = state_nk[h];
-            for(int h=i+1;h<nk;h++)
-                fs_temp[h-1] = state_nk[h];
-            prev_i = i;
-            /* search fs_temp in index of previous level */
-            unsigned long long idx_m1;
-            if (nk>1)
-                idx_m1 = index_current_level[fs_temp];
-            else
-                idx_m1 = 0;
-            /* we save the pointer to current state (idx_current) in idx_m1 - mode state_nk[i] */
-            unsigned char *ptr_pointer = _buffer+(idx_m1*_m+state_nk[i]-65)*_step;
-            int size_pointer = _step;
-            unsigned long long idx_current = k;
-            while (size_pointer--) {
-                *(ptr_pointer++) = idx_current & 0xFF;
-                idx_current >>= 8;
+     * and save them in the "map" - parent states are looked up with find_code_idx so that implicit arrays are
+     * iterated by chunks and never generated */
+    _pfsa_current->_for_each_chunk(0, _pfsa_current->_count,
+                                   [&](unsigned long long first, unsigned long long count, const char *state_nk) {
+        for(unsigned long long k=first; k<first+count; k++, state_nk+=state_size) {
+            /* starting from state_k[i*nk] => builds the fock_state-1 with one photon less */
+            int prev_i = 0;
+            for(int i=0; i<nk; i++) {
+                int mode_i = fockstate::decode_mode(state_nk, width, i);
+                if (i<_n && fockstate::decode_mode(state_nk, width, i+1) == mode_i)
+                    continue;
+                memcpy(fs_temp+prev_i*width, state_nk+prev_i*width, (i-prev_i)*width);
+                memcpy(fs_temp+i*width, state_nk+(i+1)*width, (nk-i-1)*width);
+                prev_i = i;
+                /* search fs_temp in previous level */
+                unsigned long long idx_m1 = 0;
+                if (nk>1)
+                    idx_m1 = _pfsa_parent->find_code_idx(fs_temp);
+                if (idx_m1 == fs_npos)
+                    continue;
+                /* we save the pointer to current state (idx_current) in idx_m1 - mode state_nk[i] */
+                unsigned char *ptr_pointer = _buffer+(idx_m1*_m+mode_i)*_step;
+                int size_pointer = _step;
+                unsigned long long idx_current = k;
+                while (size_pointer--) {
+                    *(ptr_pointer++) = idx_current & 0xFF;
+                    idx_current >>= 8;
+                }
             }
         }
-    }
+    });
     delete [] fs_temp;
 }
 
+fs_map::fs_map(const std::string &path, int m, int n, bool verify):_step(0), _count(0), _m(m), _n(n),
+                                                                    _buffer(nullptr), _pfsa_current(nullptr),
+                                                                    _pfsa_parent(nullptr) {
+    _load(path, fs_array(m, n+1), fs_array(m, n), verify);
+}
+
+fs_map::fs_map(const std::string &path, const fs_array &fsa_current, const fs_array &fsa_parent,
+               bool verify):_step(0), _count(0), _m(fsa_parent.get_m()), _n(fsa_parent.get_n()), _buffer(nullptr),
+                            _pfsa_current(&fsa_current), _pfsa_parent(&fsa_parent) {
+    if (fsa_current.get_m() != _m || fsa_current.get_n() != _n+1)
+        throw std::invalid_argument("incompatible fs_array layers");
+    _load(path, fsa_current, fsa_parent, verify);
+}
+
+void fs_map::_load(const std::string &path, const fs_array &fsa_current, const fs_array &fsa_parent, bool verify) {
+    std::string filename = resolve_file_path(path, DEFAULT_FILENAME, _m, _n);
+    std::shared_ptr<mapped_file> mapping = std::make_shared<mapped_file>(filename);
+    const char *data = mapping->data();
+    size_t file_size = mapping->size();
+    if (file_size < FILE_HEADER_SIZE || memcmp(data, "FSM", 3) != 0)
+        throw std::runtime_error("not a fs_map file: "+filename);
+    if ((unsigned char)data[3] != version)
+        throw std::runtime_error("unsupported fs_map file version: "+filename);
+    if (get_le(data+8, 4) != (unsigned long long)_m || get_le(data+12, 4) != (unsigned long long)_n)
+        throw std::invalid_argument("incompatible m/n in fs_map file: "+filename);
+    /* the layers of the map are identified by their flags and masks */
+    if (data[5] != fsa_parent._file_flags() || data[6] != fsa_current._file_flags())
+        throw std::invalid_argument("incompatible layers in fs_map file: "+filename);
+    size_t offset = FILE_HEADER_SIZE;
+    for (const fs_array *fsa: {&fsa_parent, &fsa_current}) {
+        std::vector<char> description = fsa->_mask_description();
+        if (file_size-offset < description.size() ||
+            (!description.empty() && memcmp(data+offset, description.data(), description.size()) != 0))
+            throw std::invalid_argument("incompatible layers in fs_map file: "+filename);
+        offset += description.size();
+    }
+    _step = data[4];
+    _count = get_le(data+16, 8);
+    if (_count != fsa_parent.count())
+        throw std::invalid_argument("incompatible layers in fs_map file: "+filename);
+    if (_step < 1 || _step > 8 || file_size-offset != size())
+        throw std::runtime_error("corrupted fs_map file: "+filename);
+    if (verify && file_checksum(data+FILE_HEADER_SIZE, file_size-FILE_HEADER_SIZE) != get_le(data+24, 8))
+        throw std::runtime_error("checksum mismatch in fs_map file: "+filename);
+    _mapping = mapping;
+    _buffer = reinterpret_cast<unsigned char *>(const_cast<char *>(data+offset));
+}
+
 fs_map::~fs_map() {
-    delete [] _buffer;
+    /* a mapped buffer is released with the mapping */
+    if (!_mapping)
+        delete [] _buffer;
+}
+
+void fs_map::save(const std::string &path) const {
+    generate();
+    std::string filename = resolve_file_path(path, DEFAULT_FILENAME, _m, _n);
+    std::vector<char> header(FILE_HEADER_SIZE, 0);
+    memcpy(header.data(), "FSM", 3);
+    header[3] = char(version);
+    header[4] = char(_step);
+    put_le(header.data()+8, _m, 4);
+    put_le(header.data()+12, _n, 4);
+    put_le(header.data()+16, _count, 8);
+    /* a map loaded without its layers is a map of the unmasked layers */
+    if (_pfsa_parent) {
+        header[5] = char(_pfsa_parent->_file_flags());
+        header[6] = char(_pfsa_current->_file_flags());
+        for (const fs_array *fsa: {_pfsa_parent, _pfsa_current}) {
+            std::vector<char> description = fsa->_mask_description();
+            header.insert(header.end(), description.begin(), description.end());
+        }
+    }
+    unsigned long long checksum = file_checksum(header.data()+FILE_HEADER_SIZE, header.size()-FILE_HEADER_SIZE);
+    put_le(header.data()+24, file_checksum(reinterpret_cast<const char *>(_buffer), size(), checksum), 8);
+    /* the file is written aside and then replaces the previous one, which may be mapped by other processes */
+    std::string tmp_filename = filename+".tmp";
+    std::ofstream f(tmp_filename, std::ios::binary | std::ios::trunc);
+    if (!f)
+        throw std::runtime_error("cannot write file "+filename);
+    f.write(header.data(), std::streamsize(header.size()));
+    f.write(reinterpret_cast<const char *>(_buffer), std::streamsize(size()));
+    f.close();
+    if (!f) {
+        std::remove(tmp_filename.c_str());
+        throw std::runtime_error("cannot write file "+filename);
+    }
+    replace_file(tmp_filename, filename);
 }
 
 unsigned long long fs_map::get(unsigned long long idx, int m) const {
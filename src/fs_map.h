@@ -25,6 +25,8 @@
 
 #include <complex>
 #include <iostream>
+#include <memory>
+#include <string>
 
 #include "fs_array.h"
 
@@ -45,6 +47,24 @@ class fs_map {
          * @throws std::out_of_range if it is not possible to find parent state associated to current state
          */
         fs_map(const fs_array &fsa_current, const fs_array &fsa_parent, bool generate=false);
+        /**
+         * Load a fs-map of the full (m, n) layer saved with save(), memory-mapped read-only
+         * @param path the file, or the directory containing the file with the default name for (m, n)
+         * @param m number of modes
+         * @param n number of photons of the parent layer
+         * @param verify check the checksum of the file - reads the whole file, so that it is off by default to keep the
+         *        loading immediate
+         * @throws std::invalid_argument if the file is not a map of the unmasked (m, n) layer
+         * @throws std::runtime_error if the file cannot be read, has an unknown version or is corrupted
+         */
+        fs_map(const std::string &path, int m, int n, bool verify=false);
+        /**
+         * Load a fs-map saved with save() for given layers, e.g. masked or collision-free ones
+         * @throws std::invalid_argument if the file is not a map between these layers: different m, n, mask or
+         *         collision-free flag
+         * @throws std::runtime_error if the file cannot be read, has an unknown version or is corrupted
+         */
+        fs_map(const std::string &path, const fs_array &fsa_current, const fs_array &fsa_parent, bool verify=false);
         /**
          * Delete a fs-map
          */
@@ -77,6 +97,12 @@ class fs_map {
         }
         unsigned long long get(unsigned long long idx, int m) const;
         void generate() const;
+        /**
+         * Save the generated map in a versioned binary file with a checksum (format in fs_map.cpp)
+         * @param path the file, or a directory where the file is saved under the default name for (m, n)
+         * @throws std::runtime_error if the file cannot be written
+         */
+        void save(const std::string &path) const;
 
         void compute_slos_layer(const std::complex<double> *p_u,
                                 int m,
@@ -85,6 +111,8 @@ class fs_map {
                                 const std::complex<double> *p_parent_coefs, unsigned long n_parent_coefs) const;
 
     private:
+        /* load the file of the map between the two layers, checking that it was saved for them */
+        void _load(const std::string &path, const fs_array &fsa_current, const fs_array &fsa_parent, bool verify);
         int _step;
         unsigned long long _count;
         int _m;
@@ -92,6 +120,8 @@ class fs_map {
         mutable unsigned char *_buffer;
         const fs_array *_pfsa_current;
         const fs_array *_pfsa_parent;
+        /* file mapped by the loading constructor, _buffer then points into it */
+        std::shared_ptr<mapped_file> _mapping;
 };
 
 #endif
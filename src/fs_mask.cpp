@@ -20,20 +20,134 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#include <algorithm>
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "fs_mask.h"
 
 fs_mask::fs_mask(int m, int n):_m(m),_n(n) {
+    _compile();
 }
 
 fs_mask::fs_mask(int m, int n, const std::string &condition):_m(m), _n(n) {
     _conditions.push_back(condition);
+    _compile();
 }
 
 fs_mask::fs_mask(int m, int n, std::list<std::string> conditions):_m(m), _n(n),
                                                                   _conditions(std::move(conditions)) {
+    _compile();
+}
+
+fs_mask::fs_mask(const fs_mask &fs):_m(fs._m), _n(fs._n), _conditions(fs._conditions), _modes(fs._modes),
+                                    _mode_lower(fs._mode_lower), _mode_upper(fs._mode_upper),
+                                    _condition_start(fs._condition_start), _required_total(fs._required_total),
+                                    _dense(fs._dense), _lower(fs._lower), _upper(fs._upper),
+                                    _modes_used(fs._modes_used) {}
+
+char fs_mask::exactly(int k) {
+    if (k < 0 || k >= 32)
+        throw std::invalid_argument("exact condition out of range");
+    return char(0x30 + k);
+}
+
+char fs_mask::at_most(int k) {
+    if (k < 0 || k >= 16)
+        throw std::invalid_argument("upper bound condition out of range");
+    return char(0x50 + k);
+}
+
+char fs_mask::at_least(int k) {
+    if (k < 0 || k >= 16)
+        throw std::invalid_argument("lower bound condition out of range");
+    return char(0x60 + k);
 }
 
-fs_mask::fs_mask(const fs_mask &fs):_m(fs._m), _n(fs._n), _conditions(fs._conditions) {}
+void fs_mask::_compile() {
+    _condition_start.assign(1, 0);
+    _modes_used = 0;
+    for(const std::string &c: _conditions) {
+        int total = 0;
+        size_t constrained = 0;
+        _lower.resize(_lower.size()+_m, 0);
+        _upper.resize(_upper.size()+_m, FS_MASK_UNBOUNDED);
+        int *lower = _lower.data()+_lower.size()-_m;
+        int *upper = _upper.data()+_upper.size()-_m;
+        for(int i=0; i<_m && i<int(c.size()); i++) {
+            if (c[i]>=0x30 && c[i]<0x50)
+                lower[i] = upper[i] = c[i] - 0x30;
+            else if (c[i]>=0x50 && c[i]<0x60)
+                upper[i] = c[i] - 0x50;
+            else if (c[i]>=0x60 && c[i]<0x70)
+                lower[i] = c[i] - 0x60;
+            if (!lower[i] && upper[i] == FS_MASK_UNBOUNDED)
+                continue;
+            _modes.push_back(i);
+            _mode_lower.push_back(lower[i]);
+            _mode_upper.push_back(upper[i]);
+            total += lower[i];
+            constrained++;
+            if (i >= _modes_used) _modes_used = i+1;
+        }
+        _condition_start.push_back(_modes.size());
+        _required_total.push_back(total);
+        /* the dense form is worth it when the constrained modes cover a large part of the modes */
+        _dense.push_back(constrained >= FS_MASK_DENSE_MIN && 4*constrained >= size_t(_m));
+    }
+}
+
+bool fs_mask::_match_condition(size_t j, const int *mode_start, int allowed_errors, bool dense) const {
+    if (dense) {
+        /* compare the whole occupancy against the dense condition, 4 modes at a time: occupations are the
+         * differences of consecutive entries of mode_start, free modes have no lower bound and an unbounded upper
+         * bound so that they need no special case */
+        const int *lower = _lower.data() + j*_m;
+        const int *upper = _upper.data() + j*_m;
+        int i = 0;
+        int deficit = 0;
+#if defined(__SSE2__)
+        __m128i deficits = _mm_setzero_si128();
+        for(; i+4<=_m; i+=4) {
+            __m128i occupation = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(mode_start+i+1)),
+                                               _mm_loadu_si128(reinterpret_cast<const __m128i *>(mode_start+i)));
+            /* there cannot be extraneous photons */
+            __m128i up = _mm_loadu_si128(reinterpret_cast<const __m128i *>(upper+i));
+            if (_mm_movemask_epi8(_mm_cmpgt_epi32(occupation, up)))
+                return false;
+            /* missing photons: max(lower-occupation, 0) */
+            __m128i missing = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(lower+i)), occupation);
+            deficits = _mm_add_epi32(deficits, _mm_andnot_si128(_mm_srai_epi32(missing, 31), missing));
+        }
+        int lanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), deficits);
+        deficit = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+        for(; i<_m; i++) {
+            int n_i = mode_start[i+1] - mode_start[i];
+            if (n_i > upper[i])
+                return false;
+            if (n_i < lower[i])
+                deficit += lower[i] - n_i;
+        }
+        return deficit <= allowed_errors;
+    }
+    /* sparse form: only the constrained modes, rejected as soon as a mode has too many photons or too many photons
+     * are missing */
+    for(size_t p=_condition_start[j]; p<_condition_start[j+1]; p++) {
+        int n_i = mode_start[_modes[p]+1] - mode_start[_modes[p]];
+        if (n_i > _mode_upper[p])
+            return false;
+        if (n_i < _mode_lower[p]) {
+            allowed_errors -= _mode_lower[p] - n_i;
+            if (allowed_errors < 0)
+                return false;
+        }
+    }
+    return true;
+}
 
 bool fs_mask::match(const fockstate &fs, bool allow_missing) const {
     /**
@@ -44,20 +158,239 @@ bool fs_mask::match(const fockstate &fs, bool allow_missing) const {
      **/
     if (_conditions.empty())
         return true;
-    for(const std::string &c: _conditions) {
-        int allowed_errors=0;
-        if (allow_missing)
-            allowed_errors = _n-fs.get_n();
-        for(int i=0; allowed_errors>=0 && i<_m; i++) {
-            if (c[i]>=0x30 && c[i]<0x50) {
-                /* there cannot be extraneous photons */
-                if (fs[i] > (c[i] - 0x30))
-                    allowed_errors = -1;
-                else
-                    allowed_errors -= c[i] - 0x30 - fs[i];
+    if (fs.get_m() < _modes_used)
+        throw std::out_of_range("invalid mode");
+    int allowed_errors = allow_missing ? _n-fs.get_n() : 0;
+    if (allowed_errors < 0)
+        return false;
+    /* occupancy table of the state, built once for all the conditions - on the stack for usual sizes */
+    int local_mode_start[FS_MASK_STACK_MODES+1];
+    std::vector<int> heap_mode_start;
+    int *mode_start = local_mode_start;
+    if (fs.get_m() > FS_MASK_STACK_MODES) {
+        heap_mode_start.resize(fs.get_m()+1);
+        mode_start = heap_mode_start.data();
+    }
+    fs._mode_starts(mode_start);
+    bool dense_allowed = fs.get_m() >= _m;
+    for(size_t j=0; j+1<_condition_start.size(); j++) {
+        /* at least required_total-n photons are missing whatever their distribution */
+        if (_required_total[j] - fs.get_n() > allowed_errors)
+            continue;
+        if (_match_condition(j, mode_start, allowed_errors, dense_allowed && _dense[j]))
+            return true;
+    }
+    return false;
+}
+
+size_t fs_mask::_bounds(std::vector<int> &lower, std::vector<int> &upper) const {
+    if (_conditions.empty()) {
+        lower.assign(_m, 0);
+        upper.assign(_m, FS_MASK_UNBOUNDED);
+        return 1;
+    }
+    lower = _lower;
+    upper = _upper;
+    return _conditions.size();
+}
+
+/* number of ways to distribute k photons over f free modes */
+static unsigned long long free_states(int f, int k) {
+    if (k < 0) return 0;
+    if (f == 0) return k == 0;
+    return fockstate::count_states(f, k);
+}
+
+/* count of the states of n photons matching a single condition with up to allowed_errors missing photons, without
+ * enumeration: ways[t][e] is the number of ways to put t photons in the constrained modes with e photons missing,
+ * each of them multiplied by the ways to put the n-t other photons in the free modes */
+static unsigned long long count_condition(const int *lower, const int *upper, int m, int n, int allowed_errors) {
+    int free_modes = 0;
+    int stride = allowed_errors+1;
+    std::vector<unsigned long long> ways(size_t(n+1)*stride, 0);
+    ways[0] = 1;
+    for(int i=0; i<m; i++) {
+        if (!lower[i] && upper[i] == FS_MASK_UNBOUNDED) {
+            free_modes++;
+            continue;
+        }
+        std::vector<unsigned long long> next(ways.size(), 0);
+        for(int t=0; t<=n; t++)
+            for(int e=0; e<=allowed_errors; e++) {
+                unsigned long long w = ways[t*stride+e];
+                if (!w) continue;
+                for(int v=0; v<=n-t && v<=upper[i]; v++) {
+                    int missing = e + (v < lower[i] ? lower[i]-v : 0);
+                    if (missing <= allowed_errors)
+                        next[(t+v)*stride+missing] += w;
+                }
             }
+        ways.swap(next);
+    }
+    unsigned long long count = 0;
+    for(int t=0; t<=n; t++)
+        for(int e=0; e<=allowed_errors; e++)
+            if (ways[t*stride+e])
+                count += ways[t*stride+e] * free_states(free_modes, n-t);
+    return count;
+}
+
+/* inclusion-exclusion over the subsets of conditions when no photon is missing: the intersection of conditions
+ * bounds each mode by the intersection of their ranges, and is empty if a range is - unsigned arithmetic wraps around,
+ * so that the alternating sum is exact as long as the result fits */
+static void inclusion_exclusion(const std::vector<int> &lower, const std::vector<int> &upper, size_t k, size_t next,
+                                const std::vector<int> &merged_lower, const std::vector<int> &merged_upper, int m,
+                                int n, bool odd, unsigned long long &total) {
+    for(size_t j=next; j<k; j++) {
+        std::vector<int> intersection_lower(merged_lower);
+        std::vector<int> intersection_upper(merged_upper);
+        bool empty = false;
+        for(int i=0; i<m && !empty; i++) {
+            intersection_lower[i] = std::max(intersection_lower[i], lower[j*m+i]);
+            intersection_upper[i] = std::min(intersection_upper[i], upper[j*m+i]);
+            empty = intersection_lower[i] > intersection_upper[i];
         }
-        if (allowed_errors>=0) return true;
+        if (empty)
+            continue;
+        unsigned long long term = count_condition(intersection_lower.data(), intersection_upper.data(), m, n, 0);
+        /* the intersections with more conditions are empty too */
+        if (!term)
+            continue;
+        if (!odd) total += term;
+        else total -= term;
+        inclusion_exclusion(lower, upper, k, j+1, intersection_lower, intersection_upper, m, n, !odd, total);
     }
-    return false;
+}
+
+/* maximal number of conditions counted by inclusion-exclusion, enumerated beyond */
+#define MAX_INCLUSION_EXCLUSION 20
+
+unsigned long long fs_mask::count(int n) const {
+    if (n < 0)
+        return 0;
+    int allowed_errors = _n-n;
+    if (_conditions.empty())
+        return fockstate::count_states(_m, n);
+    if (allowed_errors < 0)
+        return 0;
+    size_t k = _conditions.size();
+    if (k == 1)
+        return count_condition(_lower.data(), _upper.data(), _m, n, allowed_errors);
+    if (allowed_errors == 0 && k <= MAX_INCLUSION_EXCLUSION) {
+        unsigned long long total = 0;
+        inclusion_exclusion(_lower, _upper, k, 0, std::vector<int>(_m, 0), std::vector<int>(_m, FS_MASK_UNBOUNDED),
+                            _m, n, false, total);
+        return total;
+    }
+    unsigned long long total = 0;
+    enumerate(n, {}, [&total](const char *) { total++; });
+    return total;
+}
+
+namespace {
+    /* depth-first walk of the modes, distributing the photons from the highest occupation of the current mode
+     * (lexicographic order of the codes) - a branch is only followed if at least one condition can still be met,
+     * so that every branch leads to matching states */
+    class mask_walker {
+    public:
+        mask_walker(std::vector<int> lower, std::vector<int> upper, size_t k, int m, int n, int allowed_errors,
+                    const std::function<void(const char *)> &visit):
+                _lower(std::move(lower)), _upper(std::move(upper)), _k(k), _m(m), _n(n),
+                _allowed_errors(allowed_errors), _width(fockstate::code_width(m)),
+                _lower_suffix(_k*(m+1), 0), _upper_suffix(_k*(m+1), 0), _unbounded_suffix(_k*(m+1), 0),
+                _alive(_k*(m+1), 0), _deficit(_k*(m+1), 0), _code(n*_width+1), _visit(visit) {
+            for(size_t j=0; j<_k; j++)
+                for(int i=m-1; i>=0; i--) {
+                    int upper_i = _upper[j*m+i];
+                    bool unbounded = upper_i == FS_MASK_UNBOUNDED;
+                    _lower_suffix[i*_k+j] = _lower_suffix[(i+1)*_k+j] + _lower[j*m+i];
+                    _upper_suffix[i*_k+j] = _upper_suffix[(i+1)*_k+j] + (unbounded ? 0 : upper_i);
+                    _unbounded_suffix[i*_k+j] = _unbounded_suffix[(i+1)*_k+j] + unbounded;
+                }
+        }
+        void run(const std::vector<int> &prefix) {
+            bool any = false;
+            for(size_t j=0; j<_k; j++) {
+                _alive[j] = _feasible(j, 0, _n, 0);
+                any = any || _alive[j];
+            }
+            if (!any) return;
+            int remaining = _n;
+            int photon_idx = 0;
+            for(int k=0; k<int(prefix.size()); k++) {
+                int v = prefix[k];
+                if (v < 0 || v > remaining || !_step(k, v, remaining))
+                    return;
+                for(int p=0; p<v; p++)
+                    fockstate::encode_mode(_code.data(), _width, photon_idx++, k);
+                remaining -= v;
+            }
+            _walk(int(prefix.size()), remaining, photon_idx);
+        }
+    private:
+        /* can condition j be met with remaining photons on modes [k, m) and d photons already missing: the photons
+         * must fit under the upper bounds, and fill the lower bounds first */
+        inline bool _feasible(size_t j, int k, int remaining, int d) const {
+            if (!_unbounded_suffix[k*_k+j] && remaining > _upper_suffix[k*_k+j])
+                return false;
+            return d + std::max(_lower_suffix[k*_k+j] - remaining, 0) <= _allowed_errors;
+        }
+        /* set the state of the conditions after putting v photons in mode k */
+        bool _step(int k, int v, int remaining) {
+            bool any = false;
+            for(size_t j=0; j<_k; j++) {
+                bool alive = _alive[k*_k+j] != 0;
+                int d = _deficit[k*_k+j];
+                if (alive) {
+                    if (v > _upper[j*_m+k]) alive = false;
+                    else if (v < _lower[j*_m+k]) d += _lower[j*_m+k]-v;
+                    alive = alive && _feasible(j, k+1, remaining-v, d);
+                }
+                _alive[(k+1)*_k+j] = alive;
+                _deficit[(k+1)*_k+j] = d;
+                any = any || alive;
+            }
+            return any;
+        }
+        void _walk(int k, int remaining, int photon_idx) {
+            if (k == _m) {
+                _visit(_code.data());
+                return;
+            }
+            /* the last mode takes all the remaining photons */
+            int lowest = k == _m-1 ? remaining : 0;
+            for(int v=remaining; v>=lowest; v--) {
+                if (!_step(k, v, remaining))
+                    continue;
+                for(int p=0; p<v; p++)
+                    fockstate::encode_mode(_code.data(), _width, photon_idx+p, k);
+                _walk(k+1, remaining-v, photon_idx+v);
+            }
+        }
+        const std::vector<int> _lower;
+        const std::vector<int> _upper;
+        const size_t _k;
+        const int _m;
+        const int _n;
+        const int _allowed_errors;
+        const int _width;
+        std::vector<int> _lower_suffix;
+        std::vector<int> _upper_suffix;
+        std::vector<int> _unbounded_suffix;
+        std::vector<char> _alive;
+        std::vector<int> _deficit;
+        std::vector<char> _code;
+        const std::function<void(const char *)> &_visit;
+    };
+}
+
+void fs_mask::enumerate(int n, const std::vector<int> &prefix, const std::function<void(const char *)> &visit) const {
+    if (int(prefix.size()) > _m)
+        throw std::invalid_argument("prefix longer than the number of modes");
+    int allowed_errors = _conditions.empty() ? 0 : _n-n;
+    if (n < 0 || allowed_errors < 0)
+        return;
+    std::vector<int> lower, upper;
+    size_t k = _bounds(lower, upper);
+    mask_walker(std::move(lower), std::move(upper), k, _m, n, allowed_errors, visit).run(prefix);
 }
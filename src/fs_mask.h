@@ -23,8 +23,11 @@
 #ifndef QUANDELIBC_FS_MASK_H
 #define QUANDELIBC_FS_MASK_H
 
+#include <climits>
+#include <functional>
 #include <list>
 #include <string>
+#include <vector>
 
 #include "fockstate.h"
 
@@ -36,12 +39,23 @@
  * of length m with following conventions:
  *   - C[i] cannot take ',' or \x00 value - these characters are use for constructor
  *   - C[i] == ' ' if there is no constraint on mode i
- *   - C[i] == [0x30-0x50] if there are exactly ord(C[i])-48 photon in mode i (up to 32 photons)
+ *   - C[i] == [0x30-0x50[ if there are exactly ord(C[i])-0x30 photon in mode i (up to 31 photons)
+ *   - C[i] == [0x50-0x60[ if there are at most ord(C[i])-0x50 photons in mode i (up to 15 photons) - for instance
+ *     'Q' for collision-free modes
+ *   - C[i] == [0x60-0x70[ if there are at least ord(C[i])-0x60 photons in mode i (up to 15 photons)
  *   - other codes are reserved for further usage
+ *  The characters can be obtained with exactly(k), at_most(k) and at_least(k).
  *  A mask is defined for a given number of photons (n) - if the fockstate is not fully populated
  *  with n-photons then the mask can apply as long as the number of expected errors is not higher
  *  than the differences of photon count
  */
+/* minimal number of constrained modes of a condition to match it on its dense form */
+#define FS_MASK_DENSE_MIN 16
+/* states with up to this number of modes are matched without allocation */
+#define FS_MASK_STACK_MODES 256
+/* upper bound of the modes without upper bound */
+#define FS_MASK_UNBOUNDED INT_MAX
+
 class fs_mask {
 public:
     /**
@@ -77,10 +91,60 @@ public:
      * @return boolean result of the match
      */
     bool match(const fockstate &fs, bool allow_missing=true) const;
+    inline int get_m() const { return _m; }
+    inline int get_n() const { return _n; }
+    /** the condition strings of the mask **/
+    inline const std::list<std::string> &conditions() const { return _conditions; }
+    /**
+     * count the states of n photons matching the mask, without enumerating them when possible: the count of a
+     * condition is closed-form, and overlapping conditions are counted by inclusion-exclusion when n is the
+     * number of photons of the mask
+     *
+     * @param n number of photons of the states
+     * @return the number of matching states
+     */
+    unsigned long long count(int n) const;
+    /**
+     * visit in lexicographic order the codes of the states of n photons matching the mask - constrained modes are
+     * fixed and the remaining photons distributed over the free modes, so that only matching states are visited
+     *
+     * @param n number of photons of the states
+     * @param prefix fixed occupations of the first modes, restricting the visit to the states starting with them
+     * @param visit called with the n * code_width(m) bytes of the code of each matching state
+     */
+    void enumerate(int n, const std::vector<int> &prefix, const std::function<void(const char *)> &visit) const;
+    /** condition characters for exactly, at most and at least k photons in a mode
+     * @throws std::invalid_argument if k is out of the range of the condition */
+    static char exactly(int k);
+    static char at_most(int k);
+    static char at_least(int k);
 private:
+    /* build the compiled form of the conditions */
+    void _compile();
+    /* does condition j match the occupancy table of a state (see fockstate::_mode_starts) with up to
+     * allowed_errors missing photons, using the dense form of the condition if dense */
+    bool _match_condition(size_t j, const int *mode_start, int allowed_errors, bool dense) const;
+    /* dense bounds of each mode for each condition (a single free condition if the mask has no condition),
+     * returns the number of conditions */
+    size_t _bounds(std::vector<int> &lower, std::vector<int> &upper) const;
     const int _m;
     const int _n;
     std::list<std::string> _conditions;
+    /* compiled conditions: the constrained modes of condition j are _modes[_condition_start[j]:_condition_start[j+1]],
+     * sorted, with their photon count range in _mode_lower and _mode_upper, and the sum of the lower bounds in
+     * _required_total[j] */
+    std::vector<int> _modes;
+    std::vector<int> _mode_lower;
+    std::vector<int> _mode_upper;
+    std::vector<size_t> _condition_start;
+    std::vector<int> _required_total;
+    /* conditions matched on their dense form _lower[j*m:(j+1)*m] and _upper[j*m:(j+1)*m] - 0 and FS_MASK_UNBOUNDED
+     * for free modes */
+    std::vector<char> _dense;
+    std::vector<int> _lower;
+    std::vector<int> _upper;
+    /* number of modes up to the last constrained one */
+    int _modes_used;
 };
 
 #endif //QUANDELIBC_FS_MASK_H
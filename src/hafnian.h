@@ -0,0 +1,222 @@
+// MIT License
+//
+// Copyright (c) 2022 Quandela
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef _HAFNIAN_HPP
+#define _HAFNIAN_HPP
+
+/* power trace formula from Bjorklund, Gupt & Quesada 2018 (A faster hafnian formula for complex matrices and
+ * its benchmarking on a supercomputer), for a symmetric 2k by 2k matrix A:
+ *   haf(A) = sum_(S subset of [k]) (-1)^(k-|S|) [x^k] exp(sum_j tr(M_S^j) x^j / 2j)
+ * where M_S = (AX)_S keeps rows and columns i and i+k for i in S, and X swaps the two halves of the indices
+ * for loop hafnian, the exponent also includes D_S X M_S^(j-1) D_S x^j / 2 where D_S is the diagonal of A_S
+ * the power traces are calculated from the characteristic polynomial of the Hessenberg form of M_S,
+ * so each subset costs O(k^3) */
+
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "memory_tools.h"
+
+template<typename T>
+void power_traces(T *M, int d, int k, T *poly, T *p) {
+    /* compute p[j-1] = tr(M^j) for j=1..k - M is d by d and is destroyed, poly is a (d+1)*(d+1) work area */
+
+    /* reduction to Hessenberg form by stabilized elementary similarity transformations */
+    for (int r = 0; r < d - 2; r++) {
+        int pivot = r + 1;
+        for (int i = r + 2; i < d; i++)
+            if (std::abs(M[i * d + r]) > std::abs(M[pivot * d + r])) pivot = i;
+        if (pivot != r + 1) {
+            for (int j = 0; j < d; j++) std::swap(M[pivot * d + j], M[(r + 1) * d + j]);
+            for (int j = 0; j < d; j++) std::swap(M[j * d + pivot], M[j * d + r + 1]);
+        }
+        T h = M[(r + 1) * d + r];
+        if (h == T(0)) continue;
+        for (int i = r + 2; i < d; i++) {
+            T y = M[i * d + r] / h;
+            if (y == T(0)) continue;
+            M[i * d + r] = 0;
+            for (int j = r + 1; j < d; j++) M[i * d + j] -= y * M[(r + 1) * d + j];
+            for (int j = 0; j < d; j++) M[j * d + r + 1] += y * M[j * d + i];
+        }
+    }
+
+    /* characteristic polynomial det(xI-H) with the recurrence on the leading principal submatrices:
+     * P_i = (x-h_ii) P_(i-1) - sum_(l<i) h_li h_(l+1,l)...h_(i,i-1) P_(l-1) */
+    int w = d + 1;
+    std::memset((void *) poly, 0, w * w * sizeof(T));
+    poly[0] = 1;
+    for (int i = 1; i <= d; i++) {
+        T *pi = poly + i * w;
+        const T *pim1 = pi - w;
+        for (int j = 0; j < i; j++) {
+            pi[j + 1] += pim1[j];
+            pi[j] -= M[(i - 1) * d + i - 1] * pim1[j];
+        }
+        T prod = 1;
+        for (int l = i - 1; l >= 1; l--) {
+            prod *= M[l * d + l - 1];
+            T coef = M[(l - 1) * d + i - 1] * prod;
+            if (coef == T(0)) continue;
+            const T *plm1 = poly + (l - 1) * w;
+            for (int j = 0; j < l; j++) pi[j] -= coef * plm1[j];
+        }
+    }
+
+    /* Newton identities: with det(xI-H) = x^d + c_1 x^(d-1) + ... + c_d, p_j = -j c_j - sum_(l<j) c_l p_(j-l) */
+    const T *c = poly + d * w;
+    for (int j = 1; j <= k; j++) {
+        T s = j <= d ? -T(j) * c[d - j] : T(0);
+        for (int l = 1; l < j && l <= d; l++) s -= c[d - l] * p[j - l - 1];
+        p[j - 1] = s;
+    }
+}
+
+template<typename T>
+T hafnian_block(const T *A, int n, uint64_t from, uint64_t to, bool loop) {
+    /* partial sum of the power trace formula for subsets from..to-1 of the n/2 index pairs (i, i+n/2) */
+    int k = n / 2;
+    T *M, *poly, *p, *g, *e, *D, *v, *tmp;
+    int *idx;
+    CHECK_MEMALIGN(posix_memalign((void **) &M, 32, n * n * sizeof(T)));
+    CHECK_MEMALIGN(posix_memalign((void **) &poly, 32, (n + 1) * (n + 1) * sizeof(T)));
+    CHECK_MEMALIGN(posix_memalign((void **) &p, 32, k * sizeof(T)));
+    CHECK_MEMALIGN(posix_memalign((void **) &g, 32, (k + 1) * sizeof(T)));
+    CHECK_MEMALIGN(posix_memalign((void **) &e, 32, (k + 1) * sizeof(T)));
+    CHECK_MEMALIGN(posix_memalign((void **) &D, 32, n * sizeof(T)));
+    CHECK_MEMALIGN(posix_memalign((void **) &v, 32, n * sizeof(T)));
+    CHECK_MEMALIGN(posix_memalign((void **) &tmp, 32, n * sizeof(T)));
+    CHECK_MEMALIGN(posix_memalign((void **) &idx, 32, n * sizeof(int)));
+
+    T sum = 0;
+    for (uint64_t s = from; s < to; s++) {
+        int size_set = 0;
+        for (int i = 0; i < k; i++)
+            if ((s >> i) & 1) idx[size_set++] = i;
+        for (int i = 0; i < size_set; i++) idx[size_set + i] = idx[i] + k;
+        int d = 2 * size_set;
+
+        /* M = (AX)_S - X swapping the two halves */
+        for (int a = 0; a < d; a++)
+            for (int b = 0; b < d; b++)
+                M[a * d + b] = A[idx[a] * n + idx[b < size_set ? b + size_set : b - size_set]];
+
+        for (int j = 1; j <= k; j++) g[j] = 0;
+        if (loop) {
+            /* g_j += (XD)^T M^(j-1) D / 2 */
+            for (int a = 0; a < d; a++) D[a] = v[a] = A[idx[a] * n + idx[a]];
+            for (int j = 1; j <= k; j++) {
+                T r = 0;
+                for (int a = 0; a < d; a++) r += D[a < size_set ? a + size_set : a - size_set] * v[a];
+                g[j] += r / T(2);
+                if (j == k) break;
+                for (int a = 0; a < d; a++) {
+                    tmp[a] = 0;
+                    for (int b = 0; b < d; b++) tmp[a] += M[a * d + b] * v[b];
+                }
+                std::swap(v, tmp);
+            }
+        }
+
+        power_traces(M, d, k, poly, p);
+        for (int j = 1; j <= k; j++) g[j] += p[j - 1] / T(2 * j);
+
+        /* e = exp(g) as power series: m e_m = sum_j j g_j e_(m-j) */
+        e[0] = 1;
+        for (int m = 1; m <= k; m++) {
+            T r = 0;
+            for (int j = 1; j <= m; j++) r += T(j) * g[j] * e[m - j];
+            e[m] = r / T(m);
+        }
+        if ((k - size_set) % 2)
+            sum -= e[k];
+        else
+            sum += e[k];
+    }
+
+    posix_memfree(idx);
+    posix_memfree(tmp);
+    posix_memfree(v);
+    posix_memfree(D);
+    posix_memfree(e);
+    posix_memfree(g);
+    posix_memfree(p);
+    posix_memfree(poly);
+    posix_memfree(M);
+    return sum;
+}
+
+template<typename T>
+T hafnian_power_trace(const T *A, int n, int nthreads, bool loop) {
+    /* n is even - subsets are split in contiguous blocks, one per thread */
+    if (n == 0) return 1;
+    if (nthreads == 0)
+        nthreads = std::thread::hardware_concurrency();
+    if (nthreads < 1) nthreads = 1;
+    uint64_t C = uint64_t(1) << (n / 2);
+    if (uint64_t(nthreads) > C - 1) nthreads = int(C - 1);
+
+    T result = T();
+    std::vector<std::future<T>> results;
+    uint64_t start = 1;
+    uint64_t block_size = C / nthreads;
+
+    for (auto i = 0; i < nthreads; ++i) {
+        uint64_t end = (i == nthreads - 1) ? C : block_size * (i + 1);
+        results.emplace_back(std::async(std::launch::async, hafnian_block<T>, A, n, start, end, loop));
+        start = end;
+    }
+    for (auto &r: results)
+        result += r.get();
+
+    return result;
+}
+
+template<typename T>
+T hafnian(const T *A, int n, int nthreads = 0) {
+    /* hafnian of a symmetric n by n matrix - null for odd n */
+    if (A == nullptr) throw std::invalid_argument("A is null");
+    if (n % 2) return 0;
+    return hafnian_power_trace(A, n, nthreads, false);
+}
+
+template<typename T>
+T loop_hafnian(const T *A, int n, int nthreads = 0) {
+    /* loop hafnian of a symmetric n by n matrix - for odd n, a vertex with a unit loop is added */
+    if (A == nullptr) throw std::invalid_argument("A is null");
+    if (n % 2 == 0) return hafnian_power_trace(A, n, nthreads, true);
+    std::vector<T> padded((n + 1) * (n + 1));
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++)
+            padded[i * (n + 1) + j] = A[i * n + j];
+    padded[n * (n + 1) + n] = 1;
+    return hafnian_power_trace(padded.data(), n + 1, nthreads, true);
+}
+
+#endif
@@ -35,7 +35,7 @@ T multiply_row(T* A, int n)
 #ifdef __AVX__
 #include <immintrin.h>
 template<>
-std::complex<double> multiply_row<std::complex<double>>(std::complex<double>* A, int n)
+inline std::complex<double> multiply_row<std::complex<double>>(std::complex<double>* A, int n)
 {
     if (n==1) return A[0];
     // pair multiplication of complex numbers from 0 to n
@@ -64,7 +64,7 @@ std::complex<double> multiply_row<std::complex<double>>(std::complex<double>* A,
 }
 
 template<>
-double multiply_row<double>(double* A, int n)
+inline double multiply_row<double>(double* A, int n)
 {
     double rowsumprod=1;
     int lastidx=0;
@@ -25,13 +25,16 @@
 
 #include "permanent_ryser.h"
 #include "permanent_glynn.h"
+#include <string>
 #include <type_traits>
 #include <thread>
+#include <vector>
 
-template<typename T>
-T permanent(const T* A, int n, int nthreads = 0, const std::string &ptype = "") {
-    if (A == nullptr) throw std::invalid_argument("A is null");
+/* below this size, the dense algorithms are cheaper than the block decomposition and its allocations */
+#define PERMANENT_BLOCK_MIN_N 6
 
+template<typename T>
+T permanent_dense(const T* A, int n, int nthreads, const std::string &ptype) {
     /* cannot use glynn for int (need to adapt the 2 divider) */
     if (ptype == "glynn" || (ptype.size() == 0 && (nthreads == 1 || nthreads == 2))) {
         if (std::is_same<T, long long>::value)
@@ -45,4 +48,122 @@ T permanent(const T* A, int n, int nthreads = 0, const std::string &ptype = "")
     return permanent_ryser(A, n, nthreads);
 }
 
+static inline int find_component_root(std::vector<int> &parent, int k) {
+    while (parent[k] != k) {
+        parent[k] = parent[parent[k]];
+        k = parent[k];
+    }
+    return k;
+}
+
+/**
+ * connected components of the bipartite graph linking row i and column j when A[i,j] != 0
+ * row i is the node i, column j the node n+j
+ * @return the number of components, or 0 if the permanent is trivially null: empty row or column, or component
+ *         with a different number of rows and columns
+ */
+template<typename T>
+int permanent_components(const T* A, int n, std::vector<int> &component) {
+    std::vector<int> parent(2*n);
+    for (int k = 0; k < 2*n; k++) parent[k] = k;
+    std::vector<bool> col_used(n);
+    for (int i = 0, base = 0; i < n; i++, base += n) {
+        bool row_used = false;
+        for (int j = 0; j < n; j++)
+            if (A[base + j] != T(0)) {
+                row_used = true;
+                col_used[j] = true;
+                parent[find_component_root(parent, n + j)] = find_component_root(parent, i);
+            }
+        if (!row_used) return 0;
+    }
+    for (int j = 0; j < n; j++)
+        if (!col_used[j]) return 0;
+
+    /* label the components, and check that each of them is square */
+    component.assign(2*n, -1);
+    std::vector<int> balance;
+    for (int k = 0; k < 2*n; k++) {
+        int root = find_component_root(parent, k);
+        if (component[root] == -1) {
+            component[root] = int(balance.size());
+            balance.push_back(0);
+        }
+        component[k] = component[root];
+        balance[component[k]] += k < n ? 1 : -1;
+    }
+    for (int b: balance)
+        if (b) return 0;
+    return int(balance.size());
+}
+
+template<typename T>
+T permanent(const T* A, int n, int nthreads = 0, const std::string &ptype = "") {
+    if (A == nullptr) throw std::invalid_argument("A is null");
+    if (ptype == "glynn" && std::is_same<T, long long>::value)
+        throw (std::invalid_argument("cannot use glynn for int"));
+    /* permanent of the empty matrix */
+    if (n == 0)
+        return T(1);
+    if (n < PERMANENT_BLOCK_MIN_N)
+        return permanent_dense(A, n, nthreads, ptype);
+
+    /* block decomposition: the permanent of a matrix block-diagonal up to row/column permutations is the
+       product of the permanents of the blocks */
+    std::vector<int> component;
+    int ncomp = permanent_components(A, n, component);
+    if (ncomp == 0)
+        return T(0);
+    if (ncomp == 1)
+        return permanent_dense(A, n, nthreads, ptype);
+
+    T result = T(1);
+    std::vector<int> rows, cols;
+    std::vector<T> block;
+    for (int c = 0; c < ncomp; c++) {
+        rows.clear();
+        cols.clear();
+        for (int k = 0; k < n; k++) {
+            if (component[k] == c) rows.push_back(k);
+            if (component[n + k] == c) cols.push_back(k);
+        }
+        int k = int(rows.size());
+        if (k == 1) {
+            result *= A[rows[0] * n + cols[0]];
+            continue;
+        }
+        block.resize(k * k);
+        for (int i = 0; i < k; i++)
+            for (int j = 0; j < k; j++)
+                block[i * k + j] = A[rows[i] * n + cols[j]];
+        result *= permanent_dense(block.data(), k, nthreads, ptype);
+    }
+    return result;
+}
+
+/**
+ * permanent of a rectangular k by n matrix - i.e. the sum of the permanents of all its k by k (or n by n) square
+ * submatrices
+ * ptype only applies to square matrices, non-square ones are always computed with the rectangular Ryser formula
+ * @throws std::invalid_argument if ptype is "glynn" and the matrix is not square
+ */
+template<typename T>
+T permanent_rect(const T* A, int k, int n, int nthreads = 0, const std::string &ptype = "") {
+    if (A == nullptr) throw std::invalid_argument("A is null");
+    if (k == n)
+        return permanent(A, n, nthreads, ptype);
+    if (ptype == "glynn")
+        throw std::invalid_argument("cannot use glynn for rectangular matrices");
+    if (nthreads == 0)
+        nthreads = std::thread::hardware_concurrency();
+    if (k < n)
+        return permanent_ryser_rect(A, k, n, nthreads);
+    /* perm(A) = perm(A^T) */
+    std::vector<T> transposed(k * n);
+    for (int i = 0; i < k; i++)
+        for (int j = 0; j < n; j++)
+            transposed[j * k + i] = A[i * n + j];
+    return permanent_ryser_rect(transposed.data(), n, k, nthreads);
+}
+
 #endif
@@ -27,6 +27,7 @@
 #include <thread>
 #include <future>
 #include <cstdlib>
+#include <vector>
 
 #include "memory_tools.h"
 #include "optmul.h"
@@ -153,4 +154,96 @@ T permanent_ryser(const T *A, int n, int nthreads = 0) // expects n by n matrix
     return result;
 }
 
+/* rectangular extension of Ryser formula, for a k by n matrix with k <= n:
+ *   perm(A) = sum_(X subset of columns, |X| <= k) (-1)^(k-|X|) C(n-|X|, k-|X|) prod_i sum_(j in X) a_ij
+ * column subsets are visited depth-first by appending increasing columns so that only the subsets of size <= k
+ * are generated, each with a single rowsum update */
+
+static inline int rowsum_stride(int k) {
+    /* keep each rowsum vector 32-bytes aligned for multiply_row AVX loads */
+    return (k + 3) & ~3;
+}
+
+template<typename T>
+void permanent_ryser_rect_walk(const T *A, int k, int n, int first, int size_set, T *rowsums, const T *coefs,
+                               T &sum) {
+    int stride = rowsum_stride(k);
+    const T *rowsum = rowsums + size_set * stride;
+    T *new_rowsum = rowsums + (size_set + 1) * stride;
+    for (int j = first; j < n; j++) {
+        for (int m = 0, base = j; m < k; m++, base += n) new_rowsum[m] = rowsum[m] + A[base];
+        sum += coefs[size_set + 1] * multiply_row<T>(new_rowsum, k);
+        if (size_set + 1 < k)
+            permanent_ryser_rect_walk(A, k, n, j + 1, size_set + 1, rowsums, coefs, sum);
+    }
+}
+
+template<typename T>
+T permanent_ryser_rect_block(const T *A, uint64_t from, uint64_t to, int t, int k, int n, const T *coefs) {
+    /* all column subsets X0+X1 where X0 is a subset of the first t columns encoded by prefix in from..to-1, and
+       X1 a subset of the other columns */
+    T sum = 0;
+    int stride = rowsum_stride(k);
+    T *rowsums;
+    CHECK_MEMALIGN(posix_memalign((void **) &rowsums, 32, (k + 1) * stride * sizeof(T)));
+    for (uint64_t prefix = from; prefix < to; prefix++) {
+        int size_set = 0;
+        for (int j = 0; j < t; j++) size_set += (prefix >> j) & 1;
+        if (size_set > k) continue;
+        size_set = 0;
+        for (int m = 0; m < k; m++) rowsums[m] = 0;
+        for (int j = 0; j < t; j++)
+            if ((prefix >> j) & 1) {
+                const T *rowsum = rowsums + size_set * stride;
+                T *new_rowsum = rowsums + (++size_set) * stride;
+                for (int m = 0, base = j; m < k; m++, base += n) new_rowsum[m] = rowsum[m] + A[base];
+            }
+        if (size_set)
+            sum += coefs[size_set] * multiply_row<T>(rowsums + size_set * stride, k);
+        if (size_set < k)
+            permanent_ryser_rect_walk(A, k, n, t, size_set, rowsums, coefs, sum);
+    }
+    posix_memfree(rowsums);
+    return sum;
+}
+
+template<typename T>
+T permanent_ryser_rect(const T *A, int k, int n, int nthreads = 0) // expects k by n matrix with k <= n
+{
+    if (A == nullptr) throw std::invalid_argument("A is null");
+    if (k > n) throw std::invalid_argument("expects k by n matrix with k <= n");
+    if (k == 0) return 1;
+    if (nthreads < 1) nthreads = 1;
+
+    /* coefs[s] = (-1)^(k-s) C(n-s, k-s) */
+    std::vector<T> coefs(k + 1);
+    for (int s = 0; s <= k; s++) {
+        long long c = 1;
+        for (int i = 1; i <= k - s; i++) c = c * (n - k + i) / i;
+        coefs[s] = T((k - s) % 2 ? -c : c);
+    }
+
+    /* the column subsets are split on the membership of the first t columns */
+    int t = 0;
+    while (t < n && (1ULL << t) < 4ULL * nthreads) t++;
+    uint64_t C = 1ULL << t;
+    if (uint64_t(nthreads) > C) nthreads = int(C);
+
+    T result = T();
+    std::vector<std::future<T>> results;
+    uint64_t start = 0;
+    uint64_t block_size = C / nthreads;
+
+    for (auto i = 0; i < nthreads; ++i) {
+        uint64_t end = (i == nthreads - 1) ? C : block_size * (i + 1);
+        results.emplace_back(std::async(std::launch::async, permanent_ryser_rect_block<T>, A, start, end, t, k, n,
+                                        coefs.data()));
+        start = end;
+    }
+    for (auto &r: results)
+        result += r.get();
+
+    return result;
+}
+
 #endif
@@ -26,10 +26,13 @@
 #include <pybind11/operators.h>
 #include "permanent.h"
 #include "sub_permanents.h"
+#include "hafnian.h"
+#include "torontonian.h"
 #include "fockstate.h"
 #include "fs_array.h"
 #include "fs_map.h"
 #include "fs_mask.h"
+#include "state_vector.h"
 
 #define STRINGIFY(x) #x
 #define MACRO_STRINGIFY(x) STRINGIFY(x)
@@ -43,10 +46,8 @@ long long permanent_in(const py::array_t<long long, py::array::c_style | py::arr
   // check input dimensions
   if ( M.ndim()     != 2 )
     throw std::runtime_error("Input should be 2-D NumPy array");
-  if ( M.shape()[0] != M.shape()[1] )
-    throw std::runtime_error("Input should have size [N,N]");
 
-  return permanent<long long>(M.data(), M.shape()[0], n_threads, ptype);
+  return permanent_rect<long long>(M.data(), M.shape()[0], M.shape()[1], n_threads, ptype);
 }
 
 double permanent_fl(const py::array_t<double, py::array::c_style | py::array::forcecast> &M,
@@ -56,10 +57,8 @@ double permanent_fl(const py::array_t<double, py::array::c_style | py::array::fo
     // check input dimensions
   if ( M.ndim()     != 2 )
     throw std::runtime_error("Input should be 2-D NumPy array");
-  if ( M.shape()[0] != M.shape()[1] )
-    throw std::runtime_error("Input should have size [N,N]");
 
-  return permanent<double>(M.data(), M.shape()[0], n_threads, ptype);
+  return permanent_rect<double>(M.data(), M.shape()[0], M.shape()[1], n_threads, ptype);
 }
 
 std::complex<double> permanent_cx(const py::array_t<std::complex<double>, py::array::c_style | py::array::forcecast> &M,
@@ -68,10 +67,8 @@ std::complex<double> permanent_cx(const py::array_t<std::complex<double>, py::ar
   // check input dimensions
   if ( M.ndim()     != 2 )
     throw std::runtime_error("Input should be 2-D NumPy array");
-  if ( M.shape()[0] != M.shape()[1] )
-    throw std::runtime_error("Input should have size [N,N]");
 
-  return permanent<std::complex<double>>(M.data(), M.shape()[0], n_threads, ptype);
+  return permanent_rect<std::complex<double>>(M.data(), M.shape()[0], M.shape()[1], n_threads, ptype);
 }
 
 py::array_t<double> sub_permanents_fl(const py::array_t<double, py::array::c_style | py::array::forcecast> &M)
@@ -98,6 +95,84 @@ py::array_t<std::complex<double>> sub_permanents_cx(const py::array_t<std::compl
   return output;
 }
 
+py::array_t<double> permanent_gradient_fl(const py::array_t<double, py::array::c_style | py::array::forcecast> &M,
+                                          int n_threads)
+{
+  // check input dimensions
+  if ( M.ndim()     != 2 )
+    throw std::runtime_error("Input should be 2-D NumPy array");
+  if ( M.shape()[0] != M.shape()[1] )
+    throw std::runtime_error("Input should have size [N,N]");
+  py::array_t<double> output({M.shape()[0], M.shape()[1]});
+  permanent_gradient<double>(M.data(), M.shape()[0], output.mutable_data(), n_threads);
+  return output;
+}
+
+py::array_t<std::complex<double>> permanent_gradient_cx(const py::array_t<std::complex<double>, py::array::c_style | py::array::forcecast> &M,
+                                                        int n_threads)
+{
+  // check input dimensions
+  if ( M.ndim()     != 2 )
+    throw std::runtime_error("Input should be 2-D NumPy array");
+  if ( M.shape()[0] != M.shape()[1] )
+    throw std::runtime_error("Input should have size [N,N]");
+  py::array_t<std::complex<double>> output({M.shape()[0], M.shape()[1]});
+  permanent_gradient<std::complex<double>>(M.data(), M.shape()[0], output.mutable_data(), n_threads);
+  return output;
+}
+
+double hafnian_fl(const py::array_t<double, py::array::c_style | py::array::forcecast> &M,
+                  int n_threads, bool loop)
+{
+  // check input dimensions
+  if ( M.ndim()     != 2 )
+    throw std::runtime_error("Input should be 2-D NumPy array");
+  if ( M.shape()[0] != M.shape()[1] )
+    throw std::runtime_error("Input should have size [N,N]");
+
+  if (loop)
+    return loop_hafnian<double>(M.data(), M.shape()[0], n_threads);
+  return hafnian<double>(M.data(), M.shape()[0], n_threads);
+}
+
+std::complex<double> hafnian_cx(const py::array_t<std::complex<double>, py::array::c_style | py::array::forcecast> &M,
+                                int n_threads, bool loop)
+{
+  // check input dimensions
+  if ( M.ndim()     != 2 )
+    throw std::runtime_error("Input should be 2-D NumPy array");
+  if ( M.shape()[0] != M.shape()[1] )
+    throw std::runtime_error("Input should have size [N,N]");
+
+  if (loop)
+    return loop_hafnian<std::complex<double>>(M.data(), M.shape()[0], n_threads);
+  return hafnian<std::complex<double>>(M.data(), M.shape()[0], n_threads);
+}
+
+double torontonian_fl(const py::array_t<double, py::array::c_style | py::array::forcecast> &O,
+                      int n_threads)
+{
+  // check input dimensions
+  if ( O.ndim()     != 2 )
+    throw std::runtime_error("Input should be 2-D NumPy array");
+  if ( O.shape()[0] != O.shape()[1] || O.shape()[0] % 2 )
+    throw std::runtime_error("Input should have size [2N,2N]");
+
+  return torontonian<double>(O.data(), O.shape()[0] / 2, n_threads);
+}
+
+std::complex<double> torontonian_cx(const py::array_t<std::complex<double>, py::array::c_style | py::array::forcecast> &O,
+                                    int n_threads)
+{
+  // check input dimensions
+  if ( O.ndim()     != 2 )
+    throw std::runtime_error("Input should be 2-D NumPy array");
+  if ( O.shape()[0] != O.shape()[1] || O.shape()[0] % 2 )
+    throw std::runtime_error("Input should have size [2N,2N]");
+
+  return torontonian<std::complex<double>>(O.data(), O.shape()[0] / 2, n_threads);
+}
+
 fockstate get_slice(const fockstate &fs, const py::slice &slice) {
     size_t start, end, step, slice_length;
     if (!slice.compute(fs.get_m(), &start, &end, &step, &slice_length))
@@ -114,6 +189,106 @@ fockstate set_slice(const fockstate &fs1, const py::slice &slice, const fockstat
     return fs1.set_slice(fs2, start, end);
 }
 
+std::vector<fockstate> fockstates_from_array(const py::array_t<int, py::array::c_style | py::array::forcecast> &a,
+                                             int n_threads) {
+    if ( a.ndim()     != 2 )
+        throw std::runtime_error("Input should be 2-D NumPy array");
+    return fockstate::from_occupations(a.data(), a.shape()[0], int(a.shape()[1]), n_threads);
+}
+
+py::array_t<uint8_t> pack_array(const py::array_t<int, py::array::c_style | py::array::forcecast> &a,
+                                int n_threads) {
+    if ( a.ndim()     != 2 )
+        throw std::runtime_error("Input should be 2-D NumPy array");
+    int m = int(a.shape()[1]);
+    /* the number of photons is given by the first state */
+    int n = 0;
+    for (int i = 0; a.shape()[0] && i < m; i++)
+        n += a.data()[i];
+    py::array_t<uint8_t> output({(size_t)a.shape()[0], (size_t)(n * fockstate::code_width(m))});
+    fockstate::pack_occupations(a.data(), a.shape()[0], m, n, (char *)output.mutable_data(), n_threads);
+    return output;
+}
+
+py::array_t<uint8_t> pack_strings(const std::vector<std::string> &strs, int n_threads) {
+    std::vector<fockstate> states = fockstate::from_strings(strs, n_threads);
+    int code_size = states.empty() ? 0 : states[0].get_code_size();
+    py::array_t<uint8_t> output({states.size(), (size_t)code_size});
+    char *codes = (char *)output.mutable_data();
+    for (auto const &fs: states) {
+        if (!fs.get_code() || fs.get_m() != states[0].get_m() || fs.get_n() != states[0].get_n())
+            throw std::invalid_argument("states should all be defined in the same (m,n) space");
+        memcpy(codes, fs.get_code(), code_size);
+        codes += code_size;
+    }
+    return output;
+}
+
+unsigned long long find_code(const fs_array &fsa, const py::array_t<uint8_t, py::array::c_style> &code) {
+    if (code.ndim() != 1 || code.shape()[0] != fsa.get_n() * fockstate::code_width(fsa.get_m()))
+        throw std::invalid_argument("incorrect code size");
+    return fsa.find_code_idx((const char *)code.data());
+}
+
+py::array_t<unsigned long long> find_many_occupations(
+                        const fs_array &fsa,
+                        const py::array_t<int, py::array::c_style | py::array::forcecast> &a,
+                        int n_threads) {
+    if (a.ndim() != 2 || a.shape()[1] != fsa.get_m())
+        throw std::runtime_error("Input should be 2-D NumPy array with one occupation per mode");
+    py::array_t<unsigned long long> output((size_t)a.shape()[0]);
+    fsa.find_many(a.data(), a.shape()[0], output.mutable_data(), n_threads);
+    return output;
+}
+
+py::array_t<unsigned long long> find_many_codes(const fs_array &fsa,
+                                                const py::array_t<uint8_t, py::array::c_style> &codes,
+                                                int n_threads) {
+    if (codes.ndim() != 2 || codes.shape()[1] != fsa.get_n() * fockstate::code_width(fsa.get_m()))
+        throw std::runtime_error("Input should be 2-D NumPy array with one code per row");
+    py::array_t<unsigned long long> output((size_t)codes.shape()[0]);
+    fsa.find_many((const char *)codes.data(), codes.shape()[0], output.mutable_data(), n_threads);
+    return output;
+}
+
+py::tuple create_photon(const fockstate &fs, int mode) {
+    double amplitude;
+    fockstate new_fs = fs.create(mode, amplitude);
+    return py::make_tuple(new_fs, amplitude);
+}
+
+py::tuple annihilate_photon(const fockstate &fs, int mode) {
+    double amplitude;
+    fockstate new_fs = fs.annihilate(mode, amplitude);
+    if (!new_fs.get_code())
+        return py::make_tuple(py::none(), amplitude);
+    return py::make_tuple(new_fs, amplitude);
+}
+
+py::tuple operator_map(const fs_array &fsa, const fs_array &target, bool create, int n_threads) {
+    py::array_t<unsigned long long> idx({(size_t)fsa.count(), (size_t)fsa.get_m()});
+    py::array_t<double> amplitude({(size_t)fsa.count(), (size_t)fsa.get_m()});
+    if (create)
+        fsa.create_map(target, idx.mutable_data(), amplitude.mutable_data(), n_threads);
+    else
+        fsa.annihilate_map(target, idx.mutable_data(), amplitude.mutable_data(), n_threads);
+    return py::make_tuple(idx, amplitude);
+}
+
+py::array_t<std::complex<double>> sv_to_dense(const state_vector &sv, const fs_array &fsa) {
+    py::array_t<std::complex<double>> output((size_t)fsa.count());
+    sv.to_dense(fsa, output.mutable_data());
+    return output;
+}
+
+state_vector sv_from_dense(const fs_array &fsa,
+                           const py::array_t<std::complex<double>, py::array::c_style | py::array::forcecast> &coefs,
+                           double threshold) {
+    if (coefs.ndim() != 1 || (unsigned long long)coefs.shape()[0] != fsa.count())
+        throw std::runtime_error("Input should be 1-D NumPy array with one coefficient per state");
+    return state_vector::from_dense(fsa, coefs.data(), threshold);
+}
+
 void compute_slos_layer(const fs_map &fsm,
                         const py::array_t<std::complex<double>, py::array::c_style | py::array::forcecast> &u,
                         int m,
@@ -135,13 +310,13 @@ PYBIND11_MODULE(quandelibc, m) {
     m.doc() = "Optimized c-functions";
 
     m.def("permanent_in", &permanent_in,
-          "Permanent of int number (n,n) array",
+          "Permanent of int number (n,n) or rectangular (k,n) array",
           py::arg("M"), py::arg("n_threads")=1, py::arg("ptype")="");
     m.def("permanent_fl", &permanent_fl,
-          "Permanent of float number (n,n) array",
+          "Permanent of float number (n,n) or rectangular (k,n) array",
           py::arg("M"), py::arg("n_threads")=1, py::arg("ptype")="");
     m.def("permanent_cx", &permanent_cx,
-          "Permanent of complex number (n,n) array",
+          "Permanent of complex number (n,n) or rectangular (k,n) array",
           py::arg("M"), py::arg("n_threads")=1, py::arg("ptype")="");
     m.def("sub_permanents_fl", &sub_permanents_fl,
           "Permanent of n+1 (n,n) float number sub-array",
@@ -149,6 +324,25 @@ PYBIND11_MODULE(quandelibc, m) {
     m.def("sub_permanents_cx", &sub_permanents_cx,
           "Permanent of n+1 (n,n) complex number sub-array",
           py::arg("M"));
+    m.def("permanent_gradient_fl", &permanent_gradient_fl,
+          "Gradient of the permanent of float number (n,n) array: (n,n) array of (n-1,n-1) sub-array permanents",
+          py::arg("M"), py::arg("n_threads")=1);
+    m.def("permanent_gradient_cx", &permanent_gradient_cx,
+          "Gradient of the permanent of complex number (n,n) array: (n,n) array of (n-1,n-1) sub-array permanents",
+          py::arg("M"), py::arg("n_threads")=1);
+
+    m.def("hafnian_fl", &hafnian_fl,
+          "Hafnian (or loop hafnian) of float number symmetric (n,n) array",
+          py::arg("M"), py::arg("n_threads")=1, py::arg("loop")=false);
+    m.def("hafnian_cx", &hafnian_cx,
+          "Hafnian (or loop hafnian) of complex number symmetric (n,n) array",
+          py::arg("M"), py::arg("n_threads")=1, py::arg("loop")=false);
+    m.def("torontonian_fl", &torontonian_fl,
+          "Torontonian of float number (2n,2n) array",
+          py::arg("O"), py::arg("n_threads")=1);
+    m.def("torontonian_cx", &torontonian_cx,
+          "Torontonian of complex number hermitian (2n,2n) array",
+          py::arg("O"), py::arg("n_threads")=1);
 
     m.attr("npos") = py::int_(fs_npos);
 
@@ -215,6 +409,25 @@ PYBIND11_MODULE(quandelibc, m) {
         .def("photon2mode", &fockstate::photon2mode)
         .def("mode2photon", &fockstate::mode2photon)
         .def("prodnfact", &fockstate::prodnfact)
+        .def("rank", &fockstate::rank, "index of the state in the (m,n) fock space order")
+        .def_static("unrank", &fockstate::unrank, "state of given index in the (m,n) fock space order",
+                    py::arg("m"), py::arg("n"), py::arg("idx"))
+        .def_static("from_array", &fockstates_from_array,
+                    "list of states from a 2-D array of occupations, one state per row",
+                    py::arg("a"), py::arg("n_threads")=1)
+        .def_static("from_strings", &fockstate::from_strings, "list of states from their string representations",
+                    py::arg("strs"), py::arg("n_threads")=1)
+        .def_static("pack_array", &pack_array,
+                    "packed codes of the states of a 2-D array of occupations with the same number of photons",
+                    py::arg("a"), py::arg("n_threads")=1)
+        .def_static("pack_strings", &pack_strings,
+                    "packed codes of states with the same number of modes and photons from their string representations",
+                    py::arg("strs"), py::arg("n_threads")=1)
+        .def("create", &create_photon, "creation operator on a mode: tuple (new state, sqrt(n_k+1))",
+             py::arg("mode"))
+        .def("annihilate", &annihilate_photon,
+             "annihilation operator on a mode: tuple (new state, sqrt(n_k)) - (None, 0) if the mode is empty",
+             py::arg("mode"))
         .def("__copy__", &fockstate::copy)
         .def_property("m", &fockstate::get_m, nullptr)
         .def_property("n", &fockstate::get_n, nullptr);
@@ -222,29 +435,90 @@ PYBIND11_MODULE(quandelibc, m) {
     py::class_<fs_mask>(m, "FSMask")
         .def(py::init<int, int>())
         .def(py::init<int, int, std::list<std::string>>(), py::arg("m"), py::arg("n"), py::arg("conditions"))
-        .def("match", &fs_mask::match, py::arg("fs"), py::arg("allow_missing")=true);
+        .def("match", &fs_mask::match, py::arg("fs"), py::arg("allow_missing")=true)
+        .def("count", &fs_mask::count, "number of states of n photons matching the mask", py::arg("n"))
+        .def_static("exactly", &fs_mask::exactly, "condition character for exactly k photons in a mode", py::arg("k"))
+        .def_static("at_most", &fs_mask::at_most, "condition character for at most k photons in a mode", py::arg("k"))
+        .def_static("at_least", &fs_mask::at_least, "condition character for at least k photons in a mode",
+                    py::arg("k"));
 
     py::class_<fs_array>(m, "FSArray")
         .def(py::init<int, int>(), py::arg("m"), py::arg("n"))
         .def(py::init<int, int, fs_mask>(), py::arg("m"), py::arg("n"), py::arg("mask"))
+        .def(py::init<int, int, bool>(), py::arg("m"), py::arg("n"), py::arg("collision_free"))
+        .def(py::init<const std::string &, int, int, bool>(), "load an array saved with save()",
+             py::arg("path"), py::arg("m"), py::arg("n"), py::arg("verify")=false)
+        .def("save", &fs_array::save, "save the array in path, or under its default name if path is a directory",
+             py::arg("path"))
         .def("__getitem__", &fs_array::operator[], py::arg("idx"))
         .def("__iter__",
             [](const fs_array &fsa) { return py::make_iterator(fsa.begin(), fsa.end()); },
             py::keep_alive<0, 1>())
         .def("find", &fs_array::find_idx, py::arg("fs"))
+        .def("find", &find_code, py::arg("code"))
+        .def("find_many", &find_many_occupations, "indexes of the states of a 2-D array of occupations",
+             py::arg("a"), py::arg("n_threads")=1)
+        .def("find_many", &find_many_codes, "indexes of the states of a 2-D uint8 array of packed codes",
+             py::arg("codes"), py::arg("n_threads")=1)
         .def("count", &fs_array::count)
-        .def("generate", &fs_array::generate)
+        .def("generate", &fs_array::generate, py::arg("n_threads")=1)
         .def("size", &fs_array::size)
         .def_property("m", &fs_array::get_m, nullptr)
         .def_property("n", &fs_array::get_n, nullptr)
-        .def("norm_coefs", &norm_coefs);
+        .def_property("collision_free", &fs_array::is_collision_free, nullptr)
+        .def_property("implicit", &fs_array::is_implicit, nullptr)
+        .def_readwrite_static("implicit_threshold", &fs_array::implicit_threshold,
+                              "size in bytes above which new arrays are implicit")
+        .def("norm_coefs", &norm_coefs)
+        .def("create_map",
+             [](const fs_array &fsa, const fs_array &target, int n_threads) {
+                 return operator_map(fsa, target, true, n_threads); },
+             "(count, m) arrays of the indexes in target of the states created on each mode, and of the amplitudes",
+             py::arg("target"), py::arg("n_threads")=1)
+        .def("annihilate_map",
+             [](const fs_array &fsa, const fs_array &target, int n_threads) {
+                 return operator_map(fsa, target, false, n_threads); },
+             "(count, m) arrays of the indexes in target of the states annihilated on each mode, and of the amplitudes",
+             py::arg("target"), py::arg("n_threads")=1);
+
 
+    py::class_<state_vector>(m, "StateVector")
+        .def(py::init<>(), "null vector")
+        .def(py::init<const fockstate &, std::complex<double>>(), "vector of a single state",
+             py::arg("fs"), py::arg("amplitude")=1)
+        .def("add", &state_vector::add, "add amplitude to the component of a state", py::arg("fs"), py::arg("amplitude"))
+        .def("__getitem__", &state_vector::get, py::arg("fs"))
+        .def("__contains__", &state_vector::contains, py::arg("fs"))
+        .def("__len__", &state_vector::size)
+        .def("__iter__",
+            [](const state_vector &sv) { return py::make_iterator(sv.begin(), sv.end()); },
+            py::keep_alive<0, 1>())
+        .def(py::self + py::self)
+        .def(py::self += py::self)
+        .def("__mul__", &state_vector::operator*, "tensor product", py::arg("b"))
+        .def("scale", &state_vector::scale, py::arg("factor"))
+        .def("norm", &state_vector::norm)
+        .def("normalize", &state_vector::normalize)
+        .def("prune", &state_vector::prune, "remove the components with |amplitude| <= threshold",
+             py::arg("threshold")=0)
+        .def("inner", &state_vector::inner, "inner product <self|b>", py::arg("b"))
+        .def("to_dense", &sv_to_dense, "amplitudes indexed as in a FSArray", py::arg("fsa"))
+        .def_static("from_dense", &sv_from_dense, "vector from the amplitudes of the states of a FSArray",
+                    py::arg("fsa"), py::arg("coefs"), py::arg("threshold")=0);
 
     py::class_<fs_map>(m, "FSMap")
         .def(py::init<const fs_array &, const fs_array &, bool>(),
                 py::arg("fsa_current"),
                 py::arg("fsa_parent"),
                 py::arg("generate")=false)
+        .def(py::init<const std::string &, int, int, bool>(), "load a map of the unmasked layers saved with save()",
+             py::arg("path"), py::arg("m"), py::arg("n"), py::arg("verify")=false)
+        .def(py::init<const std::string &, const fs_array &, const fs_array &, bool>(),
+             "load a map between given layers saved with save()",
+             py::arg("path"), py::arg("fsa_current"), py::arg("fsa_parent"), py::arg("verify")=false,
+             py::keep_alive<1, 3>(), py::keep_alive<1, 4>())
+        .def("save", &fs_map::save, "save the map in path, or under its default name if path is a directory",
+             py::arg("path"))
         .def("get", &fs_map::get, py::arg("idx"), py::arg("mk"))
         .def("count", &fs_map::count)
         .def("size", &fs_map::size)
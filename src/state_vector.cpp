@@ -0,0 +1,170 @@
+// MIT License
+//
+// Copyright (c) 2022 Quandela
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <cmath>
+#include <stdexcept>
+
+#include "state_vector.h"
+
+const size_t state_vector::npos;
+
+state_vector::state_vector(const fockstate &fs, const std::complex<double> &amplitude) {
+    add(fs, amplitude);
+}
+
+size_t state_vector::_find(const fockstate &fs, unsigned long long h) const {
+    if (_table.empty()) return npos;
+    size_t mask = _table.size()-1;
+    for (size_t slot = h & mask; _table[slot]; slot = (slot+1) & mask) {
+        size_t idx = _table[slot]-1;
+        if (_hashes[idx] == h && _components[idx].first == fs)
+            return idx;
+    }
+    return npos;
+}
+
+void state_vector::_rehash(size_t capacity) {
+    _table.assign(capacity, 0);
+    size_t mask = capacity-1;
+    for (size_t idx = 0; idx < _components.size(); idx++) {
+        size_t slot = _hashes[idx] & mask;
+        while (_table[slot]) slot = (slot+1) & mask;
+        _table[slot] = idx+1;
+    }
+}
+
+void state_vector::add(const fockstate &fs, const std::complex<double> &amplitude) {
+    unsigned long long h = fs.hash();
+    size_t idx = _find(fs, h);
+    if (idx != npos) {
+        _components[idx].second += amplitude;
+        return;
+    }
+    _components.emplace_back(fs, amplitude);
+    _hashes.push_back(h);
+    if (2*_components.size() > _table.size())
+        _rehash(_table.empty() ? 16 : 2*_table.size());
+    else {
+        size_t mask = _table.size()-1;
+        size_t slot = h & mask;
+        while (_table[slot]) slot = (slot+1) & mask;
+        _table[slot] = _components.size();
+    }
+}
+
+std::complex<double> state_vector::get(const fockstate &fs) const {
+    size_t idx = _find(fs, fs.hash());
+    return idx == npos ? 0 : _components[idx].second;
+}
+
+state_vector &state_vector::operator+=(const state_vector &b) {
+    for (auto const &c: b._components)
+        add(c.first, c.second);
+    return *this;
+}
+
+state_vector state_vector::operator+(const state_vector &b) const {
+    state_vector sv(*this);
+    sv += b;
+    return sv;
+}
+
+void state_vector::scale(const std::complex<double> &factor) {
+    for (auto &c: _components)
+        c.second *= factor;
+}
+
+double state_vector::norm() const {
+    double sum = 0;
+    for (auto const &c: _components)
+        sum += std::norm(c.second);
+    return sqrt(sum);
+}
+
+void state_vector::normalize() {
+    double n = norm();
+    if (n == 0)
+        throw std::invalid_argument("cannot normalize null vector");
+    scale(1/n);
+}
+
+void state_vector::prune(double threshold) {
+    size_t k = 0;
+    for (size_t idx = 0; idx < _components.size(); idx++)
+        if (std::abs(_components[idx].second) > threshold) {
+            if (k != idx) {
+                _components[k] = std::move(_components[idx]);
+                _hashes[k] = _hashes[idx];
+            }
+            k++;
+        }
+    if (k == _components.size()) return;
+    _components.resize(k);
+    _hashes.resize(k);
+    _rehash(_table.size());
+}
+
+std::complex<double> state_vector::inner(const state_vector &b) const {
+    /* iterate on the smallest vector and look-up the other one */
+    const state_vector &small = size() <= b.size() ? *this : b;
+    const state_vector &large = size() <= b.size() ? b : *this;
+    std::complex<double> sum = 0;
+    for (size_t idx = 0; idx < small.size(); idx++) {
+        size_t other = large._find(small._components[idx].first, small._hashes[idx]);
+        if (other == npos) continue;
+        if (&small == this)
+            sum += std::conj(_components[idx].second) * b._components[other].second;
+        else
+            sum += std::conj(_components[other].second) * b._components[idx].second;
+    }
+    return sum;
+}
+
+state_vector state_vector::operator*(const state_vector &b) const {
+    state_vector sv;
+    for (auto const &ca: _components)
+        for (auto const &cb: b._components)
+            sv.add(ca.first * cb.first, ca.second * cb.second);
+    return sv;
+}
+
+void state_vector::to_dense(const fs_array &fsa, std::complex<double> *coefs) const {
+    for (unsigned long long i = 0; i < fsa.count(); i++)
+        coefs[i] = 0;
+    for (auto const &c: _components) {
+        if (c.first.has_annotations())
+            throw std::invalid_argument("annotated state cannot be indexed in a fock state array");
+        unsigned long long idx = fsa.find_idx(c.first);
+        if (idx == fs_npos)
+            throw std::invalid_argument("state not in the fock state array");
+        coefs[idx] += c.second;
+    }
+}
+
+state_vector state_vector::from_dense(const fs_array &fsa, const std::complex<double> *coefs, double threshold) {
+    state_vector sv;
+    unsigned long long idx = 0;
+    for (auto it = fsa.begin(); it != fsa.end(); ++it, ++idx)
+        if (std::abs(coefs[idx]) > threshold)
+            sv.add(*it, coefs[idx]);
+    return sv;
+}
@@ -0,0 +1,89 @@
+// MIT License
+//
+// Copyright (c) 2022 Quandela
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef QUANDELIBC_STATE_VECTOR_H
+#define QUANDELIBC_STATE_VECTOR_H
+
+#include <complex>
+#include <vector>
+#include <utility>
+
+#include "fockstate.h"
+#include "fs_array.h"
+
+/**
+ * sparse superposition of fock states: the components are stored in insertion order, and indexed by an open
+ * addressing hash table (linear probing) on the binary hash of the states - annotated states are distinct keys
+ */
+class state_vector {
+    public:
+        typedef std::pair<fockstate, std::complex<double>> component;
+        typedef std::vector<component>::const_iterator const_iterator;
+
+        state_vector() = default;
+        explicit state_vector(const fockstate &fs, const std::complex<double> &amplitude=1);
+
+        /* number of components */
+        size_t size() const { return _components.size(); }
+        const_iterator begin() const { return _components.begin(); }
+        const_iterator end() const { return _components.end(); }
+        /* add amplitude to the component of fs - inserted if not present */
+        void add(const fockstate &fs, const std::complex<double> &amplitude);
+        /* amplitude of the component of fs, 0 if not present */
+        std::complex<double> get(const fockstate &fs) const;
+        bool contains(const fockstate &fs) const { return _find(fs, fs.hash()) != npos; }
+        state_vector &operator+=(const state_vector &b);
+        state_vector operator+(const state_vector &b) const;
+        void scale(const std::complex<double> &factor);
+        double norm() const;
+        /**
+         * normalize the amplitudes so that norm() is 1
+         * @throws std::invalid_argument for a null vector
+         */
+        void normalize();
+        /* remove the components with |amplitude| <= threshold */
+        void prune(double threshold=0);
+        /* inner product <this|b> */
+        std::complex<double> inner(const state_vector &b) const;
+        /* tensor product, generalizing fockstate::operator* */
+        state_vector operator*(const state_vector &b) const;
+        /**
+         * amplitudes of the vector indexed as in fsa, coefs having fsa.count() elements
+         * @throws std::invalid_argument if a component is not in fsa, or is annotated - the states of a fs_array are
+         *         not annotated, so that distinguishable components would be merged
+         */
+        void to_dense(const fs_array &fsa, std::complex<double> *coefs) const;
+        /* vector of the components of fsa with |amplitude| > threshold */
+        static state_vector from_dense(const fs_array &fsa, const std::complex<double> *coefs, double threshold=0);
+    private:
+        static const size_t npos = ~size_t(0);
+        /* index in _components of fs, npos if not present */
+        size_t _find(const fockstate &fs, unsigned long long h) const;
+        void _rehash(size_t capacity);
+        std::vector<component> _components;
+        /* hash of each component */
+        std::vector<unsigned long long> _hashes;
+        /* power of 2 table of component index + 1, 0 for empty slots - load factor kept below 1/2 */
+        std::vector<size_t> _table;
+};
+
+#endif //QUANDELIBC_STATE_VECTOR_H
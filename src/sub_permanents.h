@@ -25,6 +25,13 @@
 
 /* from Clifford&Clifford 2017 paper (lemma 2) */
 
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <thread>
+#include <vector>
+
 #include "memory_tools.h"
 
 template<typename T>
@@ -90,4 +97,88 @@ void sub_permanents(const T* A, int n, T* p) {
   for(int i=0; i<m; i++) p[i] = 2.*p[i];
 }
 
+template<typename T>
+void permanent_gradient_block(const T* A, int n, uint64_t from, uint64_t to, T* g) {
+  /* accumulate in g (n*n, zero initialized) the contribution of the Glynn delta vectors graycode(from)
+     to graycode(to)-1: delta_0 is fixed to 1, bit k of the graycode set means delta_(k+1)=-1
+     d perm/d a_ij = sum_delta (prod delta) delta_j prod_(k!=i) rowsum_k/2 */
+  T *rowsum, *q;
+  CHECK_MEMALIGN(posix_memalign((void**)&rowsum, 32, n*sizeof(T)));
+  CHECK_MEMALIGN(posix_memalign((void**)&q, 32, n*sizeof(T)));
+
+  unsigned char *chi = (unsigned char*)malloc(n);
+  uint64_t graycode = from ^ (from >> 1);
+  bool s = true;
+  chi[0] = 1;
+  for(int j=1; j<n; j++) {
+    chi[j] = (graycode >> (j-1)) & 1 ? 0 : 1;
+    if (!chi[j]) s = !s;
+  }
+  for(int i=0, base=0; i<n; i++, base+=n) {
+    rowsum[i] = A[base];
+    for(int k=1; k<n; k++) rowsum[i] += chi[k] ? A[base+k] : -A[base+k];
+    rowsum[i] /= 2;
+  }
+
+  for(uint64_t k=from; k<to; k++) {
+    if (k > from) {
+      /* graycode(k) and graycode(k-1) only differ by the lowest set bit of k */
+      int j = 1;
+      for(uint64_t c=k; !(c&1); c>>=1) j++;
+      for(int i=0, base=j; i<n; i++, base+=n) rowsum[i] += chi[j] ? -A[base] : A[base];
+      chi[j] = 1-chi[j];
+      s = !s;
+    }
+    /* q[i] = sign * prod_(k!=i) rowsum_k, with prefix and suffix products */
+    T prev_value = 1;
+    for(int i=0; i<n; i++) { q[i] = prev_value; prev_value *= rowsum[i]; }
+    T t = s ? T(1) : T(-1);
+    for(int i=n-1; i>=0; i--) { q[i] *= t; t *= rowsum[i]; }
+    for(int i=0, base=0; i<n; i++, base+=n)
+      for(int j=0; j<n; j++) g[base+j] += chi[j] ? q[i] : -q[i];
+  }
+  free(chi);
+  posix_memfree(q);
+  posix_memfree(rowsum);
+}
+
+template<typename T>
+void permanent_gradient(const T* A, int n, T* g, int nthreads=0) {
+  /* we expect A to be a (n) rows, (n) columns matrix, we will return in g the (n) rows, (n) columns matrix
+     of d perm(A)/d a_ij - i.e. the permanents of the matrices excluding row i and column j
+     the 2^(n-1) Glynn delta vectors are split in contiguous graycode blocks, one per thread */
+  if (A == nullptr) throw std::invalid_argument("A is null");
+  if (n == 0) return;
+  if (n == 1) { g[0] = 1; return; }
+  if (nthreads == 0)
+    nthreads = std::thread::hardware_concurrency();
+  uint64_t C = uint64_t(1) << (n-1);
+  if (nthreads < 1) nthreads = 1;
+  if (uint64_t(nthreads) > C) nthreads = int(C);
+
+  std::vector<T*> partials(nthreads);
+  partials[0] = g;
+  for(int t=1; t<nthreads; t++)
+    CHECK_MEMALIGN(posix_memalign((void**)&partials[t], 32, n*n*sizeof(T)));
+  for(int t=0; t<nthreads; t++)
+    std::memset((void*)partials[t], 0, n*n*sizeof(T));
+
+  std::vector<std::future<void>> results;
+  uint64_t start = 0;
+  uint64_t block_size = C / nthreads;
+  for(int t=0; t<nthreads; t++) {
+    uint64_t end = (t == nthreads - 1) ? C : block_size * (t + 1);
+    results.emplace_back(std::async(std::launch::async, permanent_gradient_block<T>, A, n, start, end,
+                                    partials[t]));
+    start = end;
+  }
+  for(auto &r: results)
+    r.get();
+
+  for(int t=1; t<nthreads; t++) {
+    for(int k=0; k<n*n; k++) g[k] += partials[t][k];
+    posix_memfree(partials[t]);
+  }
+}
+
 #endif
@@ -0,0 +1,57 @@
+// MIT License
+//
+// Copyright (c) 2022 Quandela
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef QUANDELIBC_THREAD_TOOLS_H
+#define QUANDELIBC_THREAD_TOOLS_H
+
+#include <cstddef>
+#include <future>
+#include <thread>
+#include <vector>
+
+/**
+ * split [0, count) in contiguous blocks, one per thread, and run block(start, end) on each of them
+ * nthreads=0 uses all available cores - exceptions raised in a block are propagated to the caller
+ */
+template<typename F>
+void run_blocks(size_t count, int nthreads, F block) {
+    if (nthreads == 0)
+        nthreads = std::thread::hardware_concurrency();
+    if (nthreads < 1) nthreads = 1;
+    if (size_t(nthreads) > count) nthreads = int(count);
+    if (nthreads <= 1) {
+        block(size_t(0), count);
+        return;
+    }
+    std::vector<std::future<void>> results;
+    size_t start = 0;
+    size_t block_size = count / nthreads;
+    for (auto i = 0; i < nthreads; ++i) {
+        size_t end = (i == nthreads - 1) ? count : block_size * (i + 1);
+        results.emplace_back(std::async(std::launch::async, block, start, end));
+        start = end;
+    }
+    for (auto &r: results)
+        r.get();
+}
+
+#endif //QUANDELIBC_THREAD_TOOLS_H
@@ -21,8 +21,11 @@
 // SOFTWARE.
 
 
+#include <vector>
+
 #include <catch2/catch.hpp>
 #include "../src/annotation.h"
+#include "../src/thread_tools.h"
 
 SCENARIO("C++ Testing Annotation") {
     SECTION("parse incorrect annotations") {
@@ -141,4 +144,109 @@ SCENARIO("C++ Testing Annotation") {
         annotation a1("P", std::complex<float>(0, 0));
         REQUIRE(a1.to_str() == "P:H");
     }
+    SECTION("tag access, copy and comparison") {
+        annotation a("z:1,P:V,b:(1,2)");
+        REQUIRE(a.has_polarization());
+        REQUIRE(!annotation("p:0").has_polarization());
+        REQUIRE(a.to_str() == "P:V,b:(1,2),z:1");
+        std::vector<std::string> tags;
+        for(auto it: a)
+            tags.push_back(it.first);
+        REQUIRE(tags == std::vector<std::string>{"P", "b", "z"});
+        REQUIRE(a.at("b") == std::complex<float>(1, 2));
+        REQUIRE_THROWS_AS(a.at("unknown_tag"), std::out_of_range);
+        REQUIRE(a.get("unknown_tag", 3) == std::complex<float>(3));
+        REQUIRE(*a.value(annotation::intern_tag("z")) == std::complex<float>(1));
+        REQUIRE(a.value(annotation::intern_tag("y")) == nullptr);
+        annotation b(a);
+        REQUIRE(b == a);
+        b["z"] = 2;
+        REQUIRE(b != a);
+        REQUIRE(b == annotation("b:(1,2),z:2,P:V"));
+        annotation c(std::move(b));
+        REQUIRE(c.to_str() == "P:V,b:(1,2),z:2");
+        REQUIRE(b.empty());
+    }
+    SECTION("annotations with many tags") {
+        annotation a("t5:5,t4:4,t3:3,t2:2,t1:1,t0:0");
+        REQUIRE(a.size() == 6);
+        REQUIRE(a.to_str() == "t0:0,t1:1,t2:2,t3:3,t4:4,t5:5");
+        annotation b;
+        b = a;
+        REQUIRE(b == a);
+        annotation merged;
+        REQUIRE(annotation("t6:6,P:H").compatible_annotation(a, merged));
+        REQUIRE(merged.to_str() == "P:H,t0:0,t1:1,t2:2,t3:3,t4:4,t5:5,t6:6");
+        REQUIRE(!annotation("t3:1").compatible_annotation(a, merged));
+        REQUIRE(annotation("P:H").compatible_annotation(annotation("P:V"), merged));
+        REQUIRE(merged.to_str() == "P:H");
+        /* names sharing their first characters are ordered and found on the full name */
+        annotation c("long_tag_b:2,long_tag_a:1,long_tag:0,long_tag_ab:3");
+        REQUIRE(c.to_str() == "long_tag:0,long_tag_a:1,long_tag_ab:3,long_tag_b:2");
+        REQUIRE(c.at("long_tag_ab") == std::complex<float>(3));
+        REQUIRE(!c.has_tag("long_tag_c"));
+        c["long_tag_a"] = 4;
+        REQUIRE(c.to_str() == "long_tag:0,long_tag_a:4,long_tag_ab:3,long_tag_b:2");
+    }
+    SECTION("tags interned concurrently") {
+        std::vector<size_t> errors(400);
+        run_blocks(errors.size(), 4, [&errors](size_t start, size_t end) {
+            for (size_t i = start; i < end; i++) {
+                annotation a;
+                a["concurrent_tag_" + std::to_string(i)] = float(i);
+                a["concurrent_tag"] = 1;
+                if (a.to_str() != "concurrent_tag:1,concurrent_tag_" + std::to_string(i) + ":" + std::to_string(i))
+                    errors[i]++;
+                if (!a.has_tag("concurrent_tag_" + std::to_string(i)) || a.has_tag("concurrent_tag_"))
+                    errors[i]++;
+            }
+        });
+        REQUIRE(errors == std::vector<size_t>(errors.size()));
+    }
+    SECTION("interned annotations") {
+        REQUIRE(annotation_pool::intern(annotation()) == 0);
+        annot_id h = annotation_pool::intern(annotation("P:H"));
+        REQUIRE(h != 0);
+        REQUIRE(annotation_pool::intern(annotation("P:(0,0)")) == h);
+        annot_id t = annotation_pool::intern(annotation("t:1,P:V"));
+        REQUIRE(t != h);
+        REQUIRE(annotation_pool::str(t) == "P:V,t:1");
+        REQUIRE(annotation_pool::get(t).to_str() == "P:V,t:1");
+        REQUIRE(annotation_pool::has_polarization(t));
+        REQUIRE(!annotation_pool::has_polarization(0));
+        size_t size = annotation_pool::size();
+        annot_id merged;
+        REQUIRE(annotation_pool::compatible(h, t, merged));
+        REQUIRE(annotation_pool::str(merged) == "P:H,t:1");
+        REQUIRE(annotation_pool::compatible(h, t, merged));
+        REQUIRE(annotation_pool::size() == size+1);
+        REQUIRE(annotation_pool::compatible(0, h, merged));
+        REQUIRE(merged == 0);
+        REQUIRE(annotation_pool::compatible(h, 0, merged));
+        REQUIRE(merged == h);
+        REQUIRE(!annotation_pool::compatible(t, annotation_pool::intern(annotation("t:2")), merged));
+    }
+    SECTION("canonical order of interned annotations") {
+        /* ids interned concurrently, out of string order and with long common prefixes */
+        std::vector<annot_id> ids(800);
+        std::vector<size_t> inconsistent(ids.size());
+        run_blocks(ids.size(), 4, [&ids, &inconsistent](size_t start, size_t end) {
+            for (size_t i = start; i < end; i++) {
+                annotation a;
+                a[i % 2 ? "ordered_tag" : "o"] = float((i * 37) % 800);
+                if (i % 3 == 0) a["P"] = 0;
+                ids[i] = annotation_pool::intern(a);
+                for (size_t j = start; j < i; j++)
+                    if (annotation_pool::less(ids[i], ids[j]) == annotation_pool::less(ids[j], ids[i]) &&
+                        ids[i] != ids[j])
+                        inconsistent[i]++;
+            }
+        });
+        REQUIRE(inconsistent == std::vector<size_t>(ids.size()));
+        size_t mismatches = 0;
+        for (annot_id a: ids)
+            for (annot_id b: ids)
+                if (annotation_pool::less(a, b) != (annotation_pool::str(a) < annotation_pool::str(b))) mismatches++;
+        REQUIRE(mismatches == 0);
+    }
 }
@@ -25,6 +25,7 @@ import pytest
 import numpy as np
 import quandelibc as qc
 import math
+import itertools
 
 
 def test_main():
@@ -45,11 +46,84 @@ def test_basic_re():
     assert qc.permanent_fl(np.array([[1,0,1],[1,0,1],[1,0,1]])) == 0
 
 
+def test_rectangular_permanent():
+    M = np.random.rand(3, 6) + 1j * np.random.rand(3, 6)
+    expected = sum(qc.permanent_cx(M[:, list(cols)]) for cols in itertools.combinations(range(6), 3))
+    for n_threads in [1, 4]:
+        assert np.isclose(qc.permanent_cx(M, n_threads=n_threads), expected)
+        assert np.isclose(qc.permanent_cx(M.T, n_threads=n_threads), expected)
+    assert qc.permanent_in(np.ones((2, 5), dtype=int)) == 20
+
+
+def permanent_definition(M):
+    n = M.shape[0]
+    return sum(np.prod([M[i, sigma[i]] for i in range(n)]) for sigma in itertools.permutations(range(n)))
+
+
+def test_block_permanent():
+    # 7x7 block diagonal matrix with blocks of size 3 and 4, up to row/column permutation - large enough for the
+    # block decomposition
+    rng = np.random.default_rng(42)
+    B = np.zeros((7, 7), dtype=int)
+    B[:3, :3] = rng.integers(1, 10, (3, 3))
+    B[3:, 3:] = rng.integers(1, 10, (4, 4))
+    M = B[rng.permutation(7)][:, rng.permutation(7)]
+    expected = permanent_definition(M)
+    assert expected == qc.permanent_in(B[:3, :3]) * qc.permanent_in(B[3:, 3:])
+    for n_threads in [1, 4]:
+        assert qc.permanent_in(M, n_threads=n_threads) == expected
+        assert qc.permanent_fl(M, n_threads=n_threads) == expected
+        assert np.isclose(qc.permanent_cx(M * (1+1j), n_threads=n_threads), expected * (1+1j)**7)
+    # a block with a zero column cancels the permanent
+    M[:, np.nonzero(M[0])[0][0]] = 0
+    assert permanent_definition(M) == 0
+    assert qc.permanent_in(M) == 0
+    assert qc.permanent_fl(M) == 0
+
+
 def test_sub_permanents():
     assert np.allclose(qc.sub_permanents_fl(np.array([[1], [2]])), np.array([2, 1]))
     assert np.allclose(qc.sub_permanents_fl(np.array([[1,2],[3,4],[5,6]])), np.array([38., 16., 10.]))
 
 
+def test_permanent_gradient():
+    assert np.allclose(qc.permanent_gradient_fl(np.array([[1, 2], [3, 4]])), np.array([[4, 3], [2, 1]]))
+    M = np.random.rand(5, 5) + 1j * np.random.rand(5, 5)
+    for n_threads in [1, 4]:
+        grad = qc.permanent_gradient_cx(M, n_threads=n_threads)
+        assert grad.shape == (5, 5)
+        for i in range(5):
+            for j in range(5):
+                minor = np.delete(np.delete(M, i, 0), j, 1)
+                assert np.isclose(grad[i, j], qc.permanent_cx(minor))
+
+
+def test_hafnian():
+    assert np.isclose(qc.hafnian_fl(np.ones((6, 6))), 15)
+    assert np.isclose(qc.hafnian_fl(np.ones((6, 6)), loop=True), 76)
+    assert qc.hafnian_fl(np.ones((5, 5))) == 0
+    # hafnian of bipartite graph adjacency matrix is the permanent of the biadjacency matrix
+    B = np.random.rand(4, 4) + 1j * np.random.rand(4, 4)
+    A = np.block([[np.zeros((4, 4)), B], [B.T, np.zeros((4, 4))]])
+    for n_threads in [1, 3]:
+        assert np.isclose(qc.hafnian_cx(A, n_threads=n_threads), qc.permanent_cx(B))
+
+
+def test_torontonian():
+    # vacuum
+    assert np.isclose(qc.torontonian_fl(np.zeros((4, 4))), 0)
+    # product of single mode states
+    O = np.zeros((4, 4), dtype=complex)
+    O[0, 0] = O[2, 2] = 0.2
+    O[1, 1] = O[3, 3] = 0.3
+    O[0, 2] = O[2, 0] = 0.1
+    expected = (1 / np.sqrt(0.8 * 0.8 - 0.01) - 1) * (1 / np.sqrt(0.7 * 0.7) - 1)
+    for n_threads in [1, 2]:
+        assert np.isclose(qc.torontonian_cx(O, n_threads=n_threads), expected)
+    with pytest.raises(RuntimeError):
+        qc.torontonian_cx(np.zeros((3, 3)))
+
+
 def test_factorial():
     for n in range(3,14):
         assert qc.permanent_fl(np.ones((n,n), dtype=float)) == math.factorial(n), "invalid calculation for dim %d" % n
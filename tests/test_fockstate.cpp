@@ -27,6 +27,7 @@
 
 #include <catch2/catch.hpp>
 #include "../src/fockstate.h"
+#include "../src/thread_tools.h"
 
 SCENARIO("C++ Testing FockState") {
     GIVEN("an empty fockstate") {
@@ -147,6 +148,44 @@ SCENARIO("C++ Testing FockState") {
         REQUIRE(fs2.photon2mode(5) == 2);
         REQUIRE_THROWS_AS(fs2.photon2mode(7), std::out_of_range);
     }
+    SECTION("test mode to photon and range counts") {
+        fockstate fs(std::vector<int>{0, 2, 0, 3, 1});
+        REQUIRE(fs.mode2photon(0) == -1);
+        REQUIRE(fs.mode2photon(1) == 0);
+        REQUIRE(fs.mode2photon(2) == -1);
+        REQUIRE(fs.mode2photon(3) == 2);
+        REQUIRE(fs.mode2photon(4) == 5);
+        REQUIRE_THROWS_AS(fs.mode2photon(5), std::out_of_range);
+        REQUIRE(fs.photons_in_range(0, 5) == 6);
+        REQUIRE(fs.photons_in_range(1, 4) == 5);
+        REQUIRE(fs.photons_in_range(-2, 2) == 2);
+        REQUIRE(fs.photons_in_range(3, 2) == 0);
+        /* occupancy follows the state when iterating */
+        fockstate it(4, 3);
+        REQUIRE(it[0] == 3);
+        for(++it; it.get_code(); ++it) {
+            std::vector<int> v = it.to_vect();
+            for(int k=0; k<4; k++)
+                REQUIRE(it[k] == v[k]);
+            REQUIRE(it.to_str() == fockstate(v).to_str());
+        }
+        /* const accesses do not modify the state, so that it can be read from several threads */
+        const fockstate shared(std::vector<int>{1, 0, 4, 2, 0, 0, 3});
+        std::vector<int> counts(8*7);
+        std::vector<unsigned long long> hashes(8);
+        run_blocks(8, 8, [&](size_t start, size_t end) {
+            for(size_t t=start; t<end; t++) {
+                for(int k=0; k<7; k++)
+                    counts[t*7+k] = shared[k] + shared.photons_in_range(0, k);
+                hashes[t] = shared.hash();
+            }
+        });
+        for(int t=0; t<8; t++) {
+            REQUIRE(std::vector<int>(counts.begin()+t*7, counts.begin()+(t+1)*7) ==
+                    std::vector<int>({1, 1, 5, 7, 7, 7, 10}));
+            REQUIRE(hashes[t] == fockstate(std::vector<int>{1, 0, 4, 2, 0, 0, 3}).hash());
+        }
+    }
     SECTION("cast to vector, get modes, iterators on mode") {
         std::vector<int> v{1, 4, 1, 0, 6};
         fockstate fs(v);
@@ -187,6 +226,164 @@ SCENARIO("C++ Testing FockState") {
             REQUIRE(fs3.to_str(false)=="|1,0,2,1,3>");
         }
     }
+    SECTION("small and large photon buffers") {
+        int n = GENERATE(3, FS_INLINE_CODE, FS_INLINE_CODE+1, 3*FS_INLINE_CODE);
+        fockstate fs(std::vector<int>{n, 0, 1});
+        fockstate fs_copy(fs);
+        REQUIRE(fs_copy == fs);
+        fockstate fs_assign(std::vector<int>{1});
+        fs_assign = fs;
+        REQUIRE(fs_assign == fs);
+        fs_assign = fockstate(std::vector<int>{1, 1});
+        REQUIRE(fs_assign == fockstate(std::vector<int>{1, 1}));
+        ++fs_copy;
+        REQUIRE(fs_copy == fockstate(std::vector<int>{n-1, 2, 0}));
+        REQUIRE(fs == fockstate(std::vector<int>{n, 0, 1}));
+        REQUIRE((fs * fs).slice(3, 6) == fs);
+        REQUIRE(fs.set_slice(fockstate(std::vector<int>{n+1}), 1, 2) == fockstate(std::vector<int>{n, n+1, 1}));
+        fockstate fs_external(3, n+1, fs.get_code());
+        ++fs_external;
+        REQUIRE(fs == fockstate(std::vector<int>{n, 0, 1}));
+        REQUIRE(fs_external == fockstate(std::vector<int>{n-1, 2, 0}));
+    }
+    SECTION("copy-on-write and move") {
+        fockstate fs(std::vector<int>{2*FS_INLINE_CODE, 0, 1}, {{2, {"P:H"}}});
+        fockstate fs_copy(fs);
+        REQUIRE(fs_copy.get_code() == fs.get_code());
+        fs_copy.clear_annotations();
+        ++fs_copy;
+        REQUIRE(fs_copy.get_code() != fs.get_code());
+        REQUIRE(fs.to_str() == "|48,0,{P:H}>");
+        REQUIRE(fs_copy.to_str() == "|47,2,0>");
+
+        fockstate fs_annot(fs);
+        fs_annot.set_mode_annotations(2, {annotation("P:V")});
+        REQUIRE(fs_annot.to_str() == "|48,0,{P:V}>");
+        REQUIRE(fs.to_str() == "|48,0,{P:H}>");
+        fs_annot.clear_annotations();
+        REQUIRE(fs.has_annotations());
+
+        const char *code = fs.get_code();
+        fockstate fs_moved(std::move(fs));
+        REQUIRE(fs_moved.get_code() == code);
+        REQUIRE(fs_moved.to_str() == "|48,0,{P:H}>");
+        fockstate fs_small("|{P:V},1>");
+        fs_small = std::move(fs_moved);
+        REQUIRE(fs_small.get_code() == code);
+        REQUIRE(fs_small.to_str() == "|48,0,{P:H}>");
+        fs_moved = fockstate("|{P:V},1>");
+        REQUIRE(fs_moved.to_str() == "|{P:V},1>");
+    }
+    SECTION("rank and unrank") {
+        int m = GENERATE(1, 2, 5);
+        int n = GENERATE(0, 1, 4);
+        unsigned long long count = fockstate::count_states(m, n);
+        fockstate fs(m, n);
+        unsigned long long idx = 0;
+        for(; fs.get_code(); ++fs, ++idx) {
+            REQUIRE(fs.rank() == idx);
+            REQUIRE(fockstate::unrank(m, n, idx) == fs);
+        }
+        REQUIRE(idx == count);
+        REQUIRE_THROWS_AS(fockstate::unrank(m, n, count), std::out_of_range);
+        fockstate first(m, n);
+        REQUIRE((first + int(count-1)) == fockstate::unrank(m, n, count-1));
+        REQUIRE((first + int(count)).get_code() == nullptr);
+        fockstate last = fockstate::unrank(m, n, count-1);
+        last += -int(count-1);
+        REQUIRE(last == first);
+        REQUIRE((last + -1).get_code() == nullptr);
+    }
+    SECTION("rank in large spaces") {
+        fockstate fs(std::vector<int>{0, 3, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 6});
+        unsigned long long idx = fs.rank();
+        REQUIRE(fockstate::unrank(20, 10, idx) == fs);
+        REQUIRE(fockstate::unrank(20, 10, idx + 1) == fs + 1);
+        REQUIRE(fockstate::count_states(20, 10) == 20030010);
+        REQUIRE(fockstate::unrank(20, 10, 20030009) == fockstate(std::vector<int>(19)) * fockstate(std::vector<int>{10}));
+    }
+    SECTION("states with more than FS_MAX_M_CODE8 modes") {
+        std::vector<int> v(300);
+        v[0] = 1;
+        v[190] = 2;
+        v[299] = 1;
+        fockstate fs(v);
+        REQUIRE(fs.get_code_width() == 2);
+        REQUIRE(fs.get_code_size() == 8);
+        REQUIRE(fs.to_vect() == v);
+        REQUIRE(fockstate(fs.to_str().c_str()) == fs);
+        REQUIRE(fs.photon2mode(1) == 190);
+        REQUIRE(fs.photon2mode(3) == 299);
+        REQUIRE(fs.mode2photon(190) == 1);
+        REQUIRE(fs[190] == 2);
+        REQUIRE(fockstate::unrank(300, 4, fs.rank()) == fs);
+        fockstate next(fs);
+        ++next;
+        v[299] = 0;
+        v[190] = 1;
+        v[191] = 2;
+        REQUIRE(next == fockstate(v));
+        REQUIRE(fs + 1 == next);
+        /* slices switch between 1 and 2-byte codes */
+        fockstate small = fs.slice(185, 195);
+        REQUIRE(small.get_code_width() == 1);
+        REQUIRE(small.to_str() == "|0,0,0,0,0,2,0,0,0,0>");
+        REQUIRE(fs.slice(0, 100) * fs.slice(100, 300) == fs);
+        fockstate wide = fs.set_slice(fockstate(std::vector<int>{1, 1}), 298, 300);
+        REQUIRE(wide[298] == 1);
+        REQUIRE(wide[299] == 1);
+        REQUIRE(wide.get_n() == 5);
+        REQUIRE(fockstate(std::vector<int>(100, 1)) * fockstate(std::vector<int>(100, 1)) ==
+                fockstate(std::vector<int>(200, 1)));
+        REQUIRE(fockstate(std::vector<int>(200, 1)).hash() != fockstate(std::vector<int>(201, 1)).hash());
+        REQUIRE_THROWS_AS(fockstate(std::vector<int>(FS_MAX_M+1, 1)), std::invalid_argument);
+    }
+    SECTION("bulk construction") {
+        std::vector<int> occupations{0, 1, 2,
+                                     1, 0, 0,
+                                     0, 0, 0,
+                                     4, 0, 1};
+        auto nthreads = GENERATE(1, 3);
+        auto states = fockstate::from_occupations(occupations.data(), 4, 3, nthreads);
+        REQUIRE(states.size() == 4);
+        REQUIRE(states[0] == fockstate("|0,1,2>"));
+        REQUIRE(states[2] == fockstate(3));
+        REQUIRE(states[3] == fockstate("|4,0,1>"));
+        occupations[4] = -1;
+        REQUIRE_THROWS_AS(fockstate::from_occupations(occupations.data(), 4, 3, nthreads), std::invalid_argument);
+        auto parsed = fockstate::from_strings({"|0,1,2>", "[{P:H},0]", "|1,1>"}, nthreads);
+        REQUIRE(parsed[1].to_str() == "|{P:H},0>");
+        REQUIRE(parsed[2] == fockstate("|1,1>"));
+        REQUIRE_THROWS_AS(fockstate::from_strings({"|1>", "|1,"}, nthreads), std::invalid_argument);
+        std::vector<int> same_n{0, 1, 2, 3, 0, 0, 1, 1, 1};
+        std::vector<char> codes(9);
+        fockstate::pack_occupations(same_n.data(), 3, 3, 3, codes.data(), nthreads);
+        REQUIRE(std::string(codes.data(), 9) == "BCCAAAABC");
+        REQUIRE_THROWS_AS(fockstate::pack_occupations(occupations.data(), 4, 3, 3, codes.data(), nthreads),
+                          std::invalid_argument);
+    }
+    SECTION("creation and annihilation") {
+        double amplitude;
+        fockstate fs("|1,0,2>");
+        REQUIRE(fs.create(2, amplitude) == fockstate("|1,0,3>"));
+        REQUIRE(amplitude == Approx(sqrt(3)));
+        REQUIRE(fs.create(1, amplitude) == fockstate("|1,1,2>"));
+        REQUIRE(amplitude == Approx(1));
+        REQUIRE(fs.annihilate(0, amplitude) == fockstate("|0,0,2>"));
+        REQUIRE(amplitude == Approx(1));
+        REQUIRE(fs.annihilate(2, amplitude) == fockstate("|1,0,1>"));
+        REQUIRE(amplitude == Approx(sqrt(2)));
+        REQUIRE(fs.annihilate(1, amplitude).get_code() == nullptr);
+        REQUIRE(amplitude == 0);
+        REQUIRE_THROWS_AS(fs.create(3, amplitude), std::out_of_range);
+        fockstate annotated("|{P:H}1,{P:V}>");
+        REQUIRE(annotated.create(0, amplitude).to_str() == "|{P:H}2,{P:V}>");
+        REQUIRE(annotated.annihilate(0, amplitude).to_str() == "|{P:H},{P:V}>");
+        REQUIRE(annotated.annihilate(1, amplitude).to_str() == "|{P:H}1,0>");
+        fockstate large(300, 1);
+        REQUIRE(large.create(299, amplitude).get_code_size() == 4);
+        REQUIRE(large.create(299, amplitude)[299] == 1);
+    }
     SECTION("prodnfact") {
         REQUIRE(fockstate(std::vector<int>{1, 2, 3}).prodnfact()==12);
         REQUIRE(fockstate(std::vector<int>{0, 0}).prodnfact()==1);
@@ -227,6 +424,41 @@ SCENARIO("C++ Testing FockState") {
         /* we can get unlucky and get one collision, but odd of getting more than one are more than tiny */
         REQUIRE(nb_collisions <= 1);
     }
+    SECTION("hash of annotated states and modifications") {
+        REQUIRE(fockstate("|{P:H}{P:V},1>").hash() == fockstate("|{P:V}{P:H},1>").hash());
+        REQUIRE(fockstate("|{P:H},{P:V}>").hash() != fockstate("|{P:V},{P:H}>").hash());
+        REQUIRE(fockstate("|{P:H},1>").hash() != fockstate("|1,1>").hash());
+        REQUIRE(fockstate("|1,0>").hash() != fockstate("|1,0,0>").hash());
+        REQUIRE(fockstate().hash() == fockstate(0).hash());
+        fockstate fs("|1,{P:H}>");
+        fockstate fs_copy(fs);
+        auto h = fs.hash();
+        fs.set_mode_annotations(1, {annotation("P:V")});
+        REQUIRE(fs.hash() != h);
+        REQUIRE(fs != fs_copy);
+        fs.set_mode_annotations(1, {annotation("P:H")});
+        REQUIRE(fs.hash() == h);
+        REQUIRE(fs == fs_copy);
+        fs.clear_annotations();
+        REQUIRE(fs.hash() == fockstate("|1,1>").hash());
+        ++fs;
+        REQUIRE(fs.hash() == fockstate("|0,2>").hash());
+        REQUIRE(fs == fockstate("|0,2>"));
+    }
+    SECTION("annotations follow the photons") {
+        fockstate fs("|{a:1},{a:0}1>");
+        REQUIRE(fs == fockstate(std::vector<int>{1, 2}, {{1, {"a:0"}}, {0, {"a:1"}}}));
+        REQUIRE(fs != fockstate("|{a:1},{a:1}1>"));
+        ++fs;
+        REQUIRE(fs.to_str() == "|0,{a:0}{a:1}1>");
+        fs += -1;
+        REQUIRE(fs.to_str() == "|{a:0},{a:1}1>");
+        fs.set_mode_annotations(0, {annotation()});
+        REQUIRE(fs.to_str() == "|1,{a:1}1>");
+        fs.set_mode_annotations(1, {});
+        REQUIRE(!fs.has_annotations());
+        REQUIRE(fs == fockstate("|1,2>"));
+    }
     SECTION("Fockstate get slice") {
         fockstate fs(std::vector<int>{0,1,0,2,1,1});
         REQUIRE(fs.slice(0,6) == fs);
@@ -245,6 +477,7 @@ SCENARIO("C++ Testing FockState") {
                         fockstate(std::vector<int>{0,1,2,0,3,1}));
         REQUIRE_THROWS_AS(fs.set_slice(fockstate(std::vector<int>{2,0}),2,3),
                           std::invalid_argument);
+        REQUIRE(fockstate("|{P:H},1,0>").set_slice(fockstate("|{P:V}>"),2,3).to_str() == "|{P:H},1,{P:V}>");
     }
     SECTION("get mode annotation") {
         fockstate fs("|1,{A:0}2,0,{x:0,P:H}{P:V}>");
@@ -302,5 +535,14 @@ SCENARIO("C++ Testing FockState") {
             auto l = fs.separate_state();
             REQUIRE((l.size() == 2 && l.front() == fockstate("|1,0,1>") && l.back() == fockstate("|0,1,0>")));
         }
+        {
+            fockstate fs("|{_:1}{_:2},{_:1},{a:1}1,{_:2}>");
+            std::vector<int> groups;
+            REQUIRE(fs.photon_groups(groups) == 2);
+            REQUIRE(groups == std::vector<int>{0, 1, 0, 0, 0, 1});
+            auto l = fs.separate_state();
+            REQUIRE((l.size() == 2 && l.front() == fockstate("|1,1,2,0>") && l.back() == fockstate("|1,0,0,1>")));
+            REQUIRE(!l.front().has_annotations());
+        }
     }
 }
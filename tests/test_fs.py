@@ -23,6 +23,7 @@
 
 import pytest
 import quandelibc as qc
+import numpy as np
 import copy
 
 
@@ -239,6 +240,73 @@ def test_plus_1():
     for c, s in enumerate(following_fs):
         assert str(fs1 + (1 + c)) == s
 
+def test_rank_unrank():
+    fs = qc.FockState([1, 2, 3])
+    idx = fs.rank()
+    for c in range(10):
+        assert qc.FockState.unrank(3, 6, idx + c).rank() == idx + c
+    assert qc.FockState.unrank(3, 6, idx + 3) == fs + 3
+    assert qc.FockState.unrank(3, 6, 27) == qc.FockState([0, 0, 6])
+    with pytest.raises(IndexError):
+        qc.FockState.unrank(3, 6, 28)
+
+
+def test_bulk_construction():
+    a = np.array([[0, 1, 2], [3, 0, 0], [1, 1, 1]])
+    states = qc.FockState.from_array(a, n_threads=2)
+    assert states == [qc.FockState([0, 1, 2]), qc.FockState([3, 0, 0]), qc.FockState([1, 1, 1])]
+    assert qc.FockState.from_strings(["|0,1,2>", "|{P:H},1>"])[1].has_polarization
+    codes = qc.FockState.pack_array(a)
+    assert codes.shape == (3, 3)
+    assert (codes == qc.FockState.pack_strings(["|0,1,2>", "|3,0,0>", "|1,1,1>"])).all()
+    fsa = qc.FSArray(3, 3)
+    for code, fs in zip(codes, states):
+        assert fsa.find(code) == fsa.find(fs)
+    with pytest.raises(ValueError):
+        qc.FockState.pack_array(np.array([[0, 1, 2], [1, 0, 0]]))
+
+
+def test_parallel_generate():
+    fsa = qc.FSArray(6, 3, qc.FSMask(6, 3, ["1     ", "  0  2"]))
+    fsa_parallel = qc.FSArray(6, 3, qc.FSMask(6, 3, ["1     ", "  0  2"]))
+    fsa.generate()
+    fsa_parallel.generate(n_threads=3)
+    assert [str(fs) for fs in fsa] == [str(fs) for fs in fsa_parallel]
+
+
+def test_find_many():
+    fsa = qc.FSArray(4, 2)
+    a = np.array([list(fs) for fs in fsa] + [[1, 0, 0, 0]])
+    idx = fsa.find_many(a, n_threads=2)
+    assert list(idx[:-1]) == list(range(fsa.count()))
+    assert idx[-1] == qc.npos
+    codes = qc.FockState.pack_array(a[:-1])
+    assert list(fsa.find_many(codes)) == list(range(fsa.count()))
+    masked = qc.FSArray(4, 2, qc.FSMask(4, 2, ["1   "]))
+    assert list(masked.find_many(np.array([[1, 1, 0, 0], [0, 2, 0, 0]]))) == [0, qc.npos]
+    invalid = np.array([[0, ord("B")], [ord("0"), ord("B")]], dtype=np.uint8)
+    assert list(masked.find_many(invalid)) == [qc.npos, qc.npos]
+
+
+def test_create_annihilate():
+    fs = qc.FockState([1, 0, 2])
+    new_fs, amplitude = fs.create(2)
+    assert new_fs == qc.FockState([1, 0, 3])
+    assert amplitude == pytest.approx(3 ** 0.5)
+    assert fs.annihilate(1) == (None, 0)
+    fsa = qc.FSArray(3, 2)
+    fsa_up = qc.FSArray(3, 3)
+    idx, amplitudes = fsa.create_map(fsa_up)
+    assert idx.shape == (fsa.count(), 3)
+    for i in range(fsa.count()):
+        for k in range(3):
+            new_fs, amplitude = fsa[i].create(k)
+            assert fsa_up[int(idx[i, k])] == new_fs
+            assert amplitudes[i, k] == pytest.approx(amplitude)
+    idx, amplitudes = fsa.annihilate_map(qc.FSArray(3, 1))
+    assert idx[0, 1] == qc.npos and amplitudes[0, 1] == 0
+
+
 def test_annotation():
     fs = qc.FockState("|2{P:H},0>")
     assert str(fs) == "|2{P:H},0>"
@@ -20,6 +20,12 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <tuple>
+
 #include <catch2/catch.hpp>
 #include "../src/fs_array.h"
 #include "../src/fs_map.h"
@@ -89,11 +95,444 @@ SCENARIO("Testing FS Array") {
         }
         REQUIRE(idx==expected.size());
     }
+    SECTION("random access without generation") {
+        fs_array fsa(6, 3);
+        fs_array fsa_generated(6, 3);
+        fsa_generated.generate();
+        for(unsigned long long idx=0; idx<fsa.count(); idx++) {
+            REQUIRE(fsa[idx] == fsa_generated[idx]);
+            fs_array::const_iterator it(&fsa, idx);
+            REQUIRE(*it == fsa_generated[idx]);
+        }
+        fs_array::const_iterator it(&fsa, fsa.count());
+        REQUIRE(it == fsa.end());
+    }
+    SECTION("mask enumeration") {
+        std::vector<std::list<std::string>> conditions{
+            {}, {"1    1"}, {"  2   "}, {"1     ", " 1    "}, {"1  0  ", "1 1   ", "   2 1"}, {"0     ", "0     "},
+            {"111111"}, {"2 0 1 ", " 0  1 ", "2    1", "     0"}, {"QQQQQQ"}, {"R b   ", " P  a "},
+            {"a   Q ", "1 P  b", "  c   "}, {"PPP   "}};
+        for (const auto &condition: conditions) {
+            for (int n_mask = 2; n_mask <= 4; n_mask++) {
+                fs_mask mask(6, n_mask, condition);
+                for (int n = 0; n <= 4; n++) {
+                    /* reference: generate and test */
+                    std::vector<std::string> expected;
+                    for (auto fs: fs_array(6, n))
+                        if (mask.match(fs)) expected.emplace_back(fs.to_str());
+                    std::vector<std::string> enumerated;
+                    mask.enumerate(n, {}, [&enumerated, n](const char *code) {
+                        enumerated.emplace_back(fockstate(6, n, code).to_str());
+                    });
+                    REQUIRE(enumerated == expected);
+                    REQUIRE(mask.count(n) == expected.size());
+                    if (n == n_mask) {
+                        fs_array fsa(6, n, mask);
+                        REQUIRE(fsa.count() == expected.size());
+                        fsa.generate(3);
+                        for (unsigned long long idx = 0; idx < fsa.count(); idx++)
+                            REQUIRE(fsa[idx].to_str() == expected[idx]);
+                    }
+                }
+            }
+        }
+        fs_mask heralded(40, 12, std::list<std::string>{"1010101010" + std::string(30, ' '),
+                                                       "0101010101" + std::string(30, ' ')});
+        REQUIRE(heralded.count(12) == 2 * fockstate::count_states(30, 7));
+        std::vector<int> prefix{1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 7};
+        unsigned long long visited = 0;
+        heralded.enumerate(12, prefix, [&visited](const char *) { visited++; });
+        REQUIRE(visited == fockstate::count_states(29, 0));
+    }
+    SECTION("masks over fewer modes") {
+        /* the modes beyond the mask are free, as when matching the states */
+        std::vector<std::tuple<int, int, fs_mask>> cases{
+            {5, 4, fs_mask(2, 4, std::list<std::string>{"1 ", " 2"})},
+            {6, 3, fs_mask(4, 3, std::string("0 0 "))},
+            {2, 3, fs_mask(1, 3, std::string("3"))},
+            {4, 2, fs_mask(3, 2, std::list<std::string>{"Q a", "1  "})}};
+        for (const auto &c: cases) {
+            int m = std::get<0>(c), n = std::get<1>(c);
+            const fs_mask &mask = std::get<2>(c);
+            std::vector<fockstate> expected;
+            for (auto fs: fs_array(m, n))
+                if (mask.match(fs)) expected.emplace_back(fs);
+            fs_array fsa(m, n, mask);
+            REQUIRE(fsa.count() == expected.size());
+            for (unsigned long long idx = 0; idx < fsa.count(); idx++) {
+                REQUIRE(fsa[idx] == expected[idx]);
+                REQUIRE(fsa.find_idx(expected[idx]) == idx);
+            }
+            unsigned long long iterated = 0;
+            for (auto fs: fsa)
+                REQUIRE(fs == expected[iterated++]);
+            REQUIRE(iterated == expected.size());
+        }
+        /* a mask over more modes cannot require photons in the modes that are not in the array */
+        REQUIRE(fs_array(3, 2, fs_mask(5, 2, std::string("1  P`"))).count() ==
+                fs_array(3, 2, fs_mask(3, 2, std::string("1  "))).count());
+        REQUIRE_THROWS_AS(fs_array(3, 2, fs_mask(5, 2, std::string("1   a"))), std::invalid_argument);
+    }
+    SECTION("compiled mask matching") {
+        /* sparse conditions and wide conditions matched on their dense form, with a partial vector tail */
+        std::list<std::string> conditions{"1 0" + std::string(38, ' '),
+                                          std::string(3, ' ') + std::string(19, '0') + "1201" + std::string(15, ' '),
+                                          std::string(20, '1') + std::string(21, '0'),
+                                          std::string(24, fs_mask::at_most(1)) + fs_mask::at_least(2) +
+                                          std::string(15, ' ') + fs_mask::at_most(0)};
+        /* reference bounds of the modes */
+        std::vector<std::vector<int>> lower, upper;
+        for (const auto &c: conditions) {
+            lower.emplace_back(41, 0);
+            upper.emplace_back(41, 1000);
+            for (int i = 0; i < 41; i++) {
+                if (c[i] >= '0' && c[i] < 'P') lower.back()[i] = upper.back()[i] = c[i] - '0';
+                else if (c[i] >= 'P' && c[i] < '`') upper.back()[i] = c[i] - 'P';
+                else if (c[i] >= '`' && c[i] < 'p') lower.back()[i] = c[i] - '`';
+            }
+        }
+        std::mt19937 engine(42);
+        std::uniform_int_distribution<int> mode(0, 40);
+        for (int n_mask = 3; n_mask <= 20; n_mask += 17) {
+            fs_mask mask(41, n_mask, conditions);
+            for (int trial = 0; trial < 2000; trial++) {
+                int n = trial % (n_mask+1);
+                std::vector<int> occupations(41, 0);
+                /* bias the states toward the conditions so that both outcomes are tested */
+                if (trial % 2 == 0 && n == 20)
+                    for (int i = 0; i < 20; i++) occupations[i] = 1;
+                else
+                    for (int p = 0; p < n; p++) occupations[trial % 2 ? mode(engine) % 24 : mode(engine)]++;
+                fockstate fs(occupations);
+                for (bool allow_missing: {true, false}) {
+                    bool expected = false;
+                    int allowed_errors = allow_missing ? n_mask - fs.get_n() : 0;
+                    for (size_t j = 0; j < lower.size(); j++) {
+                        int errors = 0;
+                        bool extraneous = false;
+                        for (int i = 0; i < 41; i++) {
+                            if (occupations[i] > upper[j][i]) extraneous = true;
+                            else if (occupations[i] < lower[j][i]) errors += lower[j][i] - occupations[i];
+                        }
+                        expected = expected || (!extraneous && errors <= allowed_errors);
+                    }
+                    REQUIRE(mask.match(fs, allow_missing) == expected);
+                }
+            }
+        }
+    }
+    SECTION("collision-free arrays") {
+        auto n = GENERATE(0, 1, 3, 6);
+        fs_array fsa(7, n, true);
+        fs_array masked(7, n, fs_mask(7, n, std::string(7, fs_mask::at_most(1))));
+        REQUIRE(fsa.is_collision_free());
+        unsigned long long expected_count = 1;
+        for (int i = 0; i < n; i++) expected_count = expected_count * (7-i) / (i+1);
+        REQUIRE(fsa.count() == expected_count);
+        REQUIRE(masked.count() == expected_count);
+        unsigned long long idx = 0;
+        for (auto fs: fsa) {
+            REQUIRE(fs == masked[idx]);
+            REQUIRE(fsa[idx] == fs);
+            REQUIRE(fsa.find_idx(fs) == idx);
+            fs_array::const_iterator it(&fsa, idx);
+            REQUIRE(*it == fs);
+            idx++;
+        }
+        REQUIRE(idx == expected_count);
+        if (n > 1)
+            REQUIRE(fsa.find_idx(fockstate(std::vector<int>{2, 0, 0, 0, 0, 0, n-2})) == fs_npos);
+        fs_array generated(7, n, true);
+        generated.generate(3);
+        for (idx = 0; idx < expected_count; idx++)
+            REQUIRE(generated[idx] == masked[idx]);
+        REQUIRE(fs_array(3, 4, true).count() == 0);
+        fs_array large(100, 10, true);
+        fockstate fs = large[large.count()-1];
+        REQUIRE(fs[99] == 1);
+        REQUIRE(fs[90] == 1);
+        REQUIRE(large.find_idx(fs) == large.count()-1);
+    }
+    SECTION("saving and loading") {
+        std::string dir = std::filesystem::temp_directory_path().string();
+        std::string path = dir + "/quandelibc-test.fsa";
+        fs_array fsa(5, 3, fs_mask(5, 3, std::list<std::string>{"1    ", " Q  b"}));
+        fsa.save(path);
+        fs_array loaded(path, 5, 3);
+        REQUIRE(loaded.count() == fsa.count());
+        for (unsigned long long idx = 0; idx < fsa.count(); idx++) {
+            REQUIRE(loaded[idx] == fsa[idx]);
+            REQUIRE(loaded.find_idx(fsa[idx]) == idx);
+        }
+        REQUIRE(loaded.find_idx(fockstate(std::vector<int>{0, 0, 3, 0, 0})) == fs_npos);
+        REQUIRE_THROWS_AS(fs_array(path, 5, 2), std::invalid_argument);
+        /* saving again replaces the file, arrays already loaded keep their content */
+        fs_array other(5, 3, fs_mask(5, 3, std::string("  1  ")));
+        other.save(path);
+        REQUIRE(fs_array(path, 5, 3).count() == other.count());
+        for (unsigned long long idx = 0; idx < fsa.count(); idx++)
+            REQUIRE(loaded[idx] == fsa[idx]);
+        REQUIRE(!std::filesystem::exists(path + ".tmp"));
+        fsa.save(path);
+        /* corrupted codes */
+        {
+            std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+            f.seekp(-1, std::ios::end);
+            f.put('A');
+        }
+        REQUIRE_THROWS_AS(fs_array(path, 5, 3, true), std::runtime_error);
+        REQUIRE(fs_array(path, 5, 3).count() == fsa.count());
+        std::remove(path.c_str());
+        REQUIRE_THROWS_AS(fs_array(path, 5, 3), std::runtime_error);
+        /* default names in a directory */
+        fs_array collision_free(6, 3, true);
+        collision_free.save(dir);
+        fs_array loaded_collision_free(dir, 6, 3);
+        REQUIRE(loaded_collision_free.is_collision_free());
+        REQUIRE(loaded_collision_free.find_idx(collision_free[7]) == 7);
+        std::remove((dir + "/layer-m6-n3.fsa").c_str());
+        fs_array parent(4, 2);
+        fs_array current(4, 3);
+        fs_map fsm(current, parent);
+        fsm.save(dir);
+        fs_map loaded_fsm(dir, 4, 2);
+        REQUIRE(loaded_fsm.count() == fsm.count());
+        for (unsigned long long idx = 0; idx < fsm.count(); idx++)
+            for (int k = 0; k < 4; k++)
+                REQUIRE(loaded_fsm.get(idx, k) == fsm.get(idx, k));
+        REQUIRE_THROWS_AS(fs_map(dir, 5, 2), std::runtime_error);
+        REQUIRE_THROWS_AS(fs_array(dir + "/map-m4-n2.fsm", 4, 2), std::runtime_error);
+        /* maps of masked or collision-free layers are only loaded with the same layers */
+        fs_mask mask(4, 3, "1   ");
+        fs_array masked_parent(4, 2, mask);
+        fs_array masked_current(4, 3, mask);
+        fs_map masked_fsm(masked_current, masked_parent);
+        masked_fsm.save(dir);
+        REQUIRE_THROWS_AS(fs_map(dir, 4, 2), std::invalid_argument);
+        REQUIRE_THROWS_AS(fs_map(dir, current, parent), std::invalid_argument);
+        fs_array other_parent(4, 2, fs_mask(4, 3, " 1  "));
+        fs_array other_current(4, 3, fs_mask(4, 3, " 1  "));
+        REQUIRE_THROWS_AS(fs_map(dir, other_current, other_parent), std::invalid_argument);
+        fs_map loaded_masked_fsm(dir, masked_current, masked_parent, true);
+        for (unsigned long long idx = 0; idx < masked_fsm.count(); idx++)
+            for (int k = 0; k < 4; k++)
+                REQUIRE(loaded_masked_fsm.get(idx, k) == masked_fsm.get(idx, k));
+        fs_array collision_free_parent(4, 2, true);
+        fs_array collision_free_current(4, 3, true);
+        fs_map(collision_free_current, collision_free_parent).save(dir);
+        REQUIRE_THROWS_AS(fs_map(dir, 4, 2), std::invalid_argument);
+        REQUIRE(fs_map(dir, collision_free_current, collision_free_parent).count() == collision_free_parent.count());
+        std::remove((dir + "/map-m4-n2.fsm").c_str());
+    }
+    SECTION("implicit arrays") {
+        fs_array huge(60, 10);
+        REQUIRE(huge.is_implicit());
+        REQUIRE(huge.count() == 340032449328ULL);
+        fockstate fs = huge[5000000000ULL];
+        REQUIRE(huge.find_idx(fs) == 5000000000ULL);
+        REQUIRE(huge[huge.count()-1][59] == 10);
+        REQUIRE(fs_array(100, 10, true).is_implicit());
+        unsigned long long threshold = fs_array::implicit_threshold;
+        fs_array::implicit_threshold = 0;
+        fs_array fsa(6, 3);
+        fs_array collision_free(6, 3, true);
+        fs_array current(6, 4);
+        fs_array masked(6, 3, fs_mask(6, 3));
+        fs_array::implicit_threshold = threshold;
+        fs_array generated_current(6, 4);
+        REQUIRE(fsa.is_implicit());
+        REQUIRE(collision_free.is_implicit());
+        REQUIRE(!masked.is_implicit());
+        fsa.generate(4);
+        fs_array generated(6, 3);
+        generated.generate();
+        unsigned long long idx = 0;
+        for (auto fs_it: fsa) {
+            REQUIRE(fs_it == generated[idx]);
+            REQUIRE(fsa[idx] == fs_it);
+            REQUIRE(fsa.find_idx(fs_it) == idx);
+            idx++;
+        }
+        REQUIRE(idx == generated.count());
+        std::vector<std::complex<double>> coefs(fsa.count(), 1), expected_coefs(fsa.count(), 1);
+        fsa.norm_coefs(coefs.data());
+        generated.norm_coefs(expected_coefs.data());
+        REQUIRE(coefs == expected_coefs);
+        std::vector<unsigned long long> map_idx(fsa.count()*6), expected_idx(fsa.count()*6);
+        fsa.create_map(current, map_idx.data(), nullptr, 2);
+        generated.create_map(generated_current, expected_idx.data(), nullptr);
+        REQUIRE(map_idx == expected_idx);
+        /* implicit collision-free source, unranked concurrently by the threads */
+        fs_array generated_collision_free(6, 3, true);
+        generated_collision_free.generate();
+        for (int delta: {1, -1}) {
+            fs_array target(6, 3+delta);
+            size_t size = collision_free.count()*6;
+            std::vector<unsigned long long> cf_idx(size), expected_cf_idx(size);
+            std::vector<double> amplitude(size), expected_amplitude(size);
+            if (delta > 0) {
+                collision_free.create_map(target, cf_idx.data(), amplitude.data(), 4);
+                generated_collision_free.create_map(target, expected_cf_idx.data(), expected_amplitude.data());
+            } else {
+                collision_free.annihilate_map(target, cf_idx.data(), amplitude.data(), 4);
+                generated_collision_free.annihilate_map(target, expected_cf_idx.data(), expected_amplitude.data());
+            }
+            REQUIRE(cf_idx == expected_cf_idx);
+            REQUIRE(amplitude == expected_amplitude);
+        }
+        fs_map fsm(current, fsa);
+        fs_map expected_fsm(generated_current, generated);
+        for (idx = 0; idx < fsm.count(); idx++)
+            for (int k = 0; k < 6; k++)
+                REQUIRE(fsm.get(idx, k) == expected_fsm.get(idx, k));
+        std::string path = std::filesystem::temp_directory_path().string() + "/quandelibc-implicit.fsa";
+        collision_free.save(path);
+        fs_array loaded(path, 6, 3);
+        REQUIRE(!loaded.is_implicit());
+        for (idx = 0; idx < collision_free.count(); idx++)
+            REQUIRE(loaded[idx] == collision_free[idx]);
+        std::remove(path.c_str());
+    }
+    SECTION("parallel generation") {
+        auto nthreads = GENERATE(2, 5, 0);
+        fs_array fsa(7, 4);
+        fs_array fsa_parallel(7, 4);
+        fsa.generate();
+        fsa_parallel.generate(nthreads);
+        for (unsigned long long idx = 0; idx < fsa.count(); idx++)
+            REQUIRE(fsa[idx] == fsa_parallel[idx]);
+        fs_mask mask(7, 4, std::list<std::string>{"  2    ", "1     0"});
+        fs_array masked(7, 4, mask);
+        fs_array masked_parallel(7, 4, mask);
+        masked.generate();
+        masked_parallel.generate(nthreads);
+        for (unsigned long long idx = 0; idx < masked.count(); idx++)
+            REQUIRE(masked[idx] == masked_parallel[idx]);
+        fs_array empty(3, 0);
+        empty.generate(nthreads);
+        REQUIRE(empty[0].to_str() == "|0,0,0>");
+    }
+    SECTION("finding by rank without generation") {
+        fs_array fsa(6, 3);
+        fs_array fsa_generated(6, 3, fs_mask(6, 3));
+        fsa_generated.generate();
+        for(unsigned long long idx=0; idx<fsa.count(); idx++)
+            REQUIRE(fsa.find_idx(fsa_generated[idx]) == idx);
+        REQUIRE(fsa.size() == fsa.count() * 3);
+        fs_array large(40, 20);
+        fockstate fs(std::vector<int>{0, 3, 0, 0, 5, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0,
+                                      0, 0, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 9});
+        REQUIRE(large.find_idx(fs) == fs.rank());
+        REQUIRE(large[large.find_idx(fs)] == fs);
+        REQUIRE(large.find_code_idx("BBBBBBBBBBBBBBBBBBBA") == fs_npos);
+        REQUIRE(large.find_code_idx("AAAAAAAAAAAAAAAAAAAz") == fs_npos);
+    }
+    SECTION("iterating and finding with 2-byte codes") {
+        fs_array fsa(200, 2);
+        fsa.generate();
+        fockstate fs(200, 2);
+        unsigned long long idx = 0;
+        for(auto fs_it: fsa) {
+            REQUIRE(fs_it == fs);
+            REQUIRE(fsa.find_idx(fs) == idx);
+            ++fs;
+            ++idx;
+        }
+        REQUIRE(idx == fsa.count());
+    }
     SECTION("finding in fsa") {
         fs_array fsa(2, 1);
         REQUIRE(fsa.find_idx(fockstate(std::vector<int>{1,0})) == 0);
         REQUIRE(fsa.find_idx(fockstate(std::vector<int>{0,1})) == 1);
     }
+    SECTION("finding packed codes") {
+        fs_array fsa(6, 3);
+        std::vector<int> occupations{0, 1, 0, 2, 0, 0,
+                                     3, 0, 0, 0, 0, 0,
+                                     0, 0, 0, 0, 1, 2};
+        std::vector<char> codes(3 * 3);
+        fockstate::pack_occupations(occupations.data(), 3, 6, 3, codes.data(), 2);
+        for(int r=0; r<3; r++) {
+            std::vector<int> row(occupations.begin()+6*r, occupations.begin()+6*(r+1));
+            REQUIRE(fsa.find_code_idx(codes.data()+3*r) == fsa.find_idx(fockstate(row)));
+        }
+        REQUIRE(fsa.find_code_idx(codes.data()+3) == 0);
+        fs_array empty(3, 2, fs_mask(3, 2, std::string("3  ")));
+        REQUIRE(empty.count() == 0);
+        REQUIRE(empty.find_code_idx(codes.data()) == fs_npos);
+        /* bytes below the code of mode 0 */
+        fs_array masked(6, 3, fs_mask(6, 3, std::string("1     ")));
+        REQUIRE(masked.find_code_idx("0AB") == fs_npos);
+        REQUIRE(masked.find_code_idx(std::string("\0AB", 3).c_str()) == fs_npos);
+        REQUIRE(masked.find_code_idx("ABB") == masked.find_idx(fockstate(std::vector<int>{1, 2, 0, 0, 0, 0})));
+    }
+    SECTION("batched lookups") {
+        auto nthreads = GENERATE(1, 4);
+        fs_array fsa(5, 3);
+        fs_array masked(5, 3, fs_mask(5, 3, std::list<std::string>{"  1  ", "0   0"}));
+        std::vector<int> occupations;
+        for (auto fs: fsa) {
+            auto v = fs.to_vect();
+            occupations.insert(occupations.end(), v.begin(), v.end());
+        }
+        /* invalid rows: wrong photon count, negative count */
+        occupations.insert(occupations.end(), {1, 0, 0, 0, 0, 2, 2, 0, 0, -1});
+        size_t count = occupations.size() / 5;
+        std::vector<unsigned long long> idx(count);
+        std::vector<unsigned long long> masked_idx(count);
+        fsa.find_many(occupations.data(), count, idx.data(), nthreads);
+        masked.find_many(occupations.data(), count, masked_idx.data(), nthreads);
+        for (unsigned long long i = 0; i < fsa.count(); i++) {
+            REQUIRE(idx[i] == i);
+            REQUIRE(masked_idx[i] == masked.find_idx(fsa[i]));
+        }
+        REQUIRE(idx[count-2] == fs_npos);
+        REQUIRE(idx[count-1] == fs_npos);
+        REQUIRE(masked_idx[count-1] == fs_npos);
+        std::vector<char> codes(masked.count() * 3);
+        std::vector<int> masked_occupations;
+        for (auto fs: masked) {
+            auto v = fs.to_vect();
+            masked_occupations.insert(masked_occupations.end(), v.begin(), v.end());
+        }
+        fockstate::pack_occupations(masked_occupations.data(), masked.count(), 5, 3, codes.data());
+        masked.find_many(codes.data(), masked.count(), idx.data(), nthreads);
+        for (unsigned long long i = 0; i < masked.count(); i++)
+            REQUIRE(idx[i] == i);
+    }
+    SECTION("creation and annihilation maps") {
+        fs_array fsa(4, 2);
+        fs_array fsa_up(4, 3);
+        fs_array fsa_down(4, 1);
+        std::vector<unsigned long long> idx(fsa.count() * 4);
+        std::vector<double> amplitude(fsa.count() * 4);
+        auto nthreads = GENERATE(1, 3);
+        fsa.create_map(fsa_up, idx.data(), amplitude.data(), nthreads);
+        for(unsigned long long i=0; i<fsa.count(); i++)
+            for(int k=0; k<4; k++) {
+                double a;
+                fockstate created = fsa[i].create(k, a);
+                REQUIRE(fsa_up[idx[i*4+k]] == created);
+                REQUIRE(amplitude[i*4+k] == Approx(a));
+            }
+        fsa.annihilate_map(fsa_down, idx.data(), amplitude.data(), nthreads);
+        for(unsigned long long i=0; i<fsa.count(); i++)
+            for(int k=0; k<4; k++) {
+                double a;
+                fockstate annihilated = fsa[i].annihilate(k, a);
+                REQUIRE(amplitude[i*4+k] == Approx(a));
+                if (annihilated.get_code())
+                    REQUIRE(fsa_down[idx[i*4+k]] == annihilated);
+                else
+                    REQUIRE(idx[i*4+k] == fs_npos);
+            }
+        fs_array masked(4, 3, fs_mask(4, 3, std::string("1   ")));
+        fsa.create_map(masked, idx.data(), nullptr, nthreads);
+        REQUIRE(idx[0] == fs_npos);
+        REQUIRE(idx[1] == fs_npos);
+        REQUIRE(masked[idx[5]] == fockstate("|1,2,0,0>"));
+        REQUIRE_THROWS_AS(fsa.create_map(fsa_down, idx.data(), nullptr), std::invalid_argument);
+    }
     SECTION("using a fs mask") {
         fs_mask mask(5, 3, " 1 1 0");
         fs_array fsa(5, 3, mask);
@@ -150,6 +589,23 @@ SCENARIO("Testing FS Array") {
             REQUIRE(fsa_child[fsm.get(idx, 7)].to_str() == "|0,1,0,0,1,0,0,2,0>");
             REQUIRE(fsa_child[fsm.get(idx, 8)].to_str() == "|0,1,0,0,1,0,0,1,1>");
         }
+        WHEN("250 modes - photons coded on 2 bytes") {
+            fs_array fsa_parent(250, 1);
+            fs_array fsa_child(250, 2);
+            REQUIRE(fsa_child.count() == 31375);
+            REQUIRE(fsa_child.size() == 31375 * 2 * 2);
+            fs_map fsm(fsa_child, fsa_parent, false);
+            std::vector<int> v(250);
+            v[200] = 1;
+            unsigned long long idx = fsa_parent.find_idx(fockstate(v));
+            REQUIRE(idx == 200);
+            v[7] = 1;
+            REQUIRE(fsa_child[fsm.get(idx, 7)] == fockstate(v));
+            v[7] = 0;
+            v[249] = 1;
+            REQUIRE(fsa_child[fsm.get(idx, 249)] == fockstate(v));
+            REQUIRE(fsa_child.find_idx(fockstate(v)) == fockstate(v).rank());
+        }
         WHEN("9 modes - with a mask") {
             fs_mask mask(9, 4, "1       1");
             fs_array fsa_parent(9, 3, mask);
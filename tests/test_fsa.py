@@ -52,24 +52,25 @@ def test_save_fsa(tmp_path):
     fsa = qc.FSArray(3, 2)
     fsa.save(str(tmp_path / "fsa-32"))
     assert path.exists(tmp_path / "fsa-32")
-    with open(tmp_path / "fsa-32") as f:
+    with open(tmp_path / "fsa-32", "rb") as f:
         s = f.read()
-    assert s[:3] == "FSA"
-    assert s[4:5] == "6"
-    assert s[5] == '\x00'
-    assert s[8:] == "AAABACBBBCCC"
+    assert s[:3] == b"FSA"
+    assert s[3] == 3
+    assert s[4] == 0
+    assert int.from_bytes(s[16:24], "little") == 6
+    assert s[32:] == b"AAABACBBBCCC"
 
 
 def test_save_fsa_dir(tmp_path):
     fsa = qc.FSArray(3, 2)
     fsa.save(str(tmp_path))
     assert path.exists(tmp_path / "layer-m3-n2.fsa")
-    with open(tmp_path / "layer-m3-n2.fsa") as f:
+    with open(tmp_path / "layer-m3-n2.fsa", "rb") as f:
         s = f.read()
-    assert s[:3] == "FSA"
-    assert ord(s[6]) == 3
-    assert ord(s[7]) == 2
-    assert s[8:] == "AAABACBBBCCC"
+    assert s[:3] == b"FSA"
+    assert int.from_bytes(s[8:12], "little") == 3
+    assert int.from_bytes(s[12:16], "little") == 2
+    assert s[32:] == b"AAABACBBBCCC"
 
 
 def test_read_save(tmp_path):
@@ -91,6 +92,50 @@ def test_read_unknown(tmp_path):
         qc.FSArray(str(tmp_path / "unknown-fsa"), 5, 4)
 
 
+def test_read_save_masked(tmp_path):
+    fsa1 = qc.FSArray(6, 3, qc.FSMask(6, 3, ["1     ", "  " + qc.FSMask.at_least(2) + "   "]))
+    fsa1.save(str(tmp_path))
+    fsa2 = qc.FSArray(str(tmp_path), 6, 3)
+    assert [str(fs) for fs in fsa2] == [str(fs) for fs in fsa1]
+    assert fsa2.find(qc.FockState([0, 0, 2, 0, 1, 0])) == fsa1.find(qc.FockState([0, 0, 2, 0, 1, 0]))
+
+
+def test_read_corrupted(tmp_path):
+    qc.FSArray(4, 2).save(str(tmp_path / "fsa-42"))
+    with open(tmp_path / "fsa-42", "r+b") as f:
+        f.seek(-1, 2)
+        f.write(b"A")
+    with pytest.raises(RuntimeError):
+        qc.FSArray(str(tmp_path / "fsa-42"), 4, 2, verify=True)
+    assert qc.FSArray(str(tmp_path / "fsa-42"), 4, 2).count() == 10
+
+
+def test_save_fsm(tmp_path):
+    fsa_parent = qc.FSArray(3, 1)
+    fsa = qc.FSArray(3, 2)
+    fsm = qc.FSMap(fsa, fsa_parent)
+    fsm.save(str(tmp_path))
+    assert path.exists(tmp_path / "map-m3-n1.fsm")
+    fsm2 = qc.FSMap(str(tmp_path), 3, 1)
+    assert fsm2.count() == 3
+    assert fsm2.get(2, 2) == 5
+    with pytest.raises(ValueError):
+        qc.FSMap(str(tmp_path / "map-m3-n1.fsm"), 3, 2)
+
+
+def test_save_masked_fsm(tmp_path):
+    mask = qc.FSMask(3, 2, ["1  "])
+    fsa_parent = qc.FSArray(3, 1, mask)
+    fsa = qc.FSArray(3, 2, mask)
+    fsm = qc.FSMap(fsa, fsa_parent)
+    fsm.save(str(tmp_path))
+    with pytest.raises(ValueError):
+        qc.FSMap(str(tmp_path), 3, 1)
+    fsm2 = qc.FSMap(str(tmp_path), fsa, fsa_parent, verify=True)
+    assert fsm2.count() == fsm.count()
+    assert [fsm2.get(0, k) for k in range(3)] == [fsm.get(0, k) for k in range(3)]
+
+
 def test_fsm_basic():
     fsa_parent = qc.FSArray(3, 1)
     fsa = qc.FSArray(3, 2)
@@ -164,3 +209,23 @@ def test_fsa_iter_1():
         "|0,0,1>"
     ]
     assert fsa_states == [str(fs) for fs in fsa]
+
+
+def test_fsa_implicit():
+    huge = qc.FSArray(60, 10)
+    assert huge.implicit
+    fs = huge[5000000000]
+    assert huge.find(fs) == 5000000000
+    threshold = qc.FSArray.implicit_threshold
+    qc.FSArray.implicit_threshold = 0
+    try:
+        fsa = qc.FSArray(4, 2)
+    finally:
+        qc.FSArray.implicit_threshold = threshold
+    assert fsa.implicit
+    fsa.generate()
+    generated = qc.FSArray(4, 2)
+    assert not generated.implicit
+    assert [str(fs) for fs in fsa] == [str(fs) for fs in generated]
+    assert str(fsa[4]) == "|0,2,0,0>"
+    assert fsa.find(qc.FockState([0, 2, 0, 0])) == 4
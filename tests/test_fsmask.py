@@ -66,3 +66,41 @@ def test_genfsa_2():
     assert fsa_full.size() == 74256
     fsa_restricted = qc.FSArray(12, 6, fs_mask)
     assert fsa_restricted.size() == 990
+
+
+def test_count_overlapping_conditions():
+    fs_mask = qc.FSMask(6, 3, ["1     ", " 1    ", "  0   "])
+    fsa_full = qc.FSArray(6, 3)
+    expected = [fs for fs in fsa_full if fs_mask.match(fs)]
+    assert fs_mask.count(3) == len(expected)
+    fsa_restricted = qc.FSArray(6, 3, fs_mask)
+    assert fsa_restricted.count() == len(expected)
+    assert [str(fsa_restricted[i]) for i in range(fsa_restricted.count())] == [str(fs) for fs in expected]
+
+
+def test_count_heralded():
+    # 40 modes with 10 heralded modes: only the states of the 30 free modes are visited
+    fs_mask = qc.FSMask(40, 12, ["1010101010" + " " * 30])
+    assert qc.FSArray(40, 12, fs_mask).count() == qc.FSArray(30, 7).count()
+
+
+def test_bounded_conditions():
+    fs_mask = qc.FSMask(4, 3, [qc.FSMask.at_most(1) * 4])
+    assert fs_mask.match(qc.FockState([1, 1, 0, 1]))
+    assert not fs_mask.match(qc.FockState([2, 1, 0, 0]))
+    assert fs_mask.count(3) == 4
+    fs_mask = qc.FSMask(4, 3, [qc.FSMask.at_least(2) + "   "])
+    assert fs_mask.match(qc.FockState([3, 0, 0, 0]))
+    assert fs_mask.match(qc.FockState([1, 0, 0, 0]))
+    assert not fs_mask.match(qc.FockState([0, 0, 1, 1]))
+    assert not fs_mask.match(qc.FockState([1, 0, 0, 2]), allow_missing=False)
+    assert fs_mask.count(3) == 4
+
+
+def test_collision_free_array():
+    fsa = qc.FSArray(5, 2, collision_free=True)
+    assert fsa.collision_free
+    assert fsa.count() == 10
+    assert [list(fs) for fs in fsa][:2] == [[1, 1, 0, 0, 0], [1, 0, 1, 0, 0]]
+    assert fsa.find(qc.FockState([0, 0, 0, 1, 1])) == 9
+    assert fsa.find(qc.FockState([0, 0, 0, 0, 2])) == qc.npos
@@ -0,0 +1,97 @@
+// MIT License
+//
+// Copyright (c) 2022 Quandela
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <complex>
+#include <vector>
+#include <catch2/catch.hpp>
+#include "../src/hafnian.h"
+#include "../src/permanent.h"
+
+/* reference loop hafnian by expansion along the first vertex */
+template<typename T>
+static T lhaf_expand(const std::vector<T> &A, std::vector<int> vertices, bool loop) {
+    if (vertices.empty()) return 1;
+    int n = int(std::sqrt(A.size()));
+    int v0 = vertices[0];
+    std::vector<int> rest(vertices.begin() + 1, vertices.end());
+    T result = loop ? A[v0 * n + v0] * lhaf_expand(A, rest, loop) : T(0);
+    for (size_t j = 0; j < rest.size(); j++) {
+        std::vector<int> sub = rest;
+        sub.erase(sub.begin() + j);
+        result += A[v0 * n + rest[j]] * lhaf_expand(A, sub, loop);
+    }
+    return result;
+}
+
+static std::vector<std::complex<double>> symmetric_matrix(int n) {
+    std::vector<std::complex<double>> A(n * n);
+    for (int i = 0; i < n; i++)
+        for (int j = i; j < n; j++)
+            A[i * n + j] = A[j * n + i] = std::complex<double>(std::cos(3 * i + j), std::sin(i * j + 1));
+    return A;
+}
+
+SCENARIO("C++ Testing Hafnians") {
+    GIVEN("all ones matrices") {
+        auto n_threads = GENERATE(1, 3);
+        WHEN("computing hafnian") {
+            std::vector<double> ones(36, 1.);
+            THEN("hafnian is the number of perfect matchings") {
+                REQUIRE(std::abs(hafnian(ones.data(), 6, n_threads) - 15) < 1e-10);
+                REQUIRE(std::abs(hafnian(ones.data(), 4, n_threads) - 3) < 1e-10);
+                REQUIRE(hafnian(ones.data(), 5, n_threads) == 0);
+                REQUIRE(hafnian(ones.data(), 0, n_threads) == 1);
+            }
+            THEN("loop hafnian is the number of matchings") {
+                REQUIRE(std::abs(loop_hafnian(ones.data(), 6, n_threads) - 76) < 1e-10);
+                REQUIRE(std::abs(loop_hafnian(ones.data(), 5, n_threads) - 26) < 1e-10);
+            }
+        }
+    }
+    GIVEN("a complex symmetric matrix") {
+        auto n = GENERATE(2, 4, 7, 8);
+        auto n_threads = GENERATE(1, 4);
+        std::vector<std::complex<double>> A = symmetric_matrix(n);
+        std::vector<int> vertices(n);
+        for (int i = 0; i < n; i++) vertices[i] = i;
+        THEN("hafnian matches the expansion") {
+            auto expected = lhaf_expand(A, vertices, false);
+            REQUIRE(std::abs(hafnian(A.data(), n, n_threads) - expected) < 1e-9 * (1 + std::abs(expected)));
+        }
+        THEN("loop hafnian matches the expansion") {
+            auto expected = lhaf_expand(A, vertices, true);
+            REQUIRE(std::abs(loop_hafnian(A.data(), n, n_threads) - expected) < 1e-9 * (1 + std::abs(expected)));
+        }
+    }
+    GIVEN("a bipartite graph") {
+        /* haf([[0,B],[B^T,0]]) = perm(B) */
+        const int k = 5;
+        std::vector<std::complex<double>> B = symmetric_matrix(k);
+        B[1] = std::complex<double>(0.5, -2);
+        std::vector<std::complex<double>> A(4 * k * k);
+        for (int i = 0; i < k; i++)
+            for (int j = 0; j < k; j++)
+                A[i * 2 * k + k + j] = A[(k + j) * 2 * k + i] = B[i * k + j];
+        auto p = permanent_glynn(B.data(), k);
+        REQUIRE(std::abs(hafnian(A.data(), 2 * k, 2) - p) < 1e-9 * std::abs(p));
+    }
+}
@@ -1,6 +1,7 @@
 #include <complex>
 #include <catch2/catch.hpp>
 #include "../src/permanent.h"
+#include "../src/sub_permanents.h"
 #include <iostream>
 
 static std::vector<std::complex<double>> genSquaredMatrixComplex(int squaredMatrixSize)
@@ -79,4 +80,126 @@ SCENARIO("C++ Testing Permanents") {
             }
         }
     }
-}
\ No newline at end of file
+    GIVEN("the permanent gradient") {
+        WHEN("computing a complex<double> matrix of size 6") {
+            const int n = 6;
+            std::vector<std::complex<double>> matrix(n*n);
+            for (int k = 0; k < n*n; k++)
+                matrix[k] = std::complex<double>(std::cos(k), std::sin(2*k)/2);
+            std::vector<std::complex<double>> minor((n-1)*(n-1));
+            auto n_threads = GENERATE(1, 3, 64);
+            std::vector<std::complex<double>> gradient(n*n);
+            permanent_gradient(matrix.data(), n, gradient.data(), n_threads);
+            THEN("each element is the permanent of the corresponding minor") {
+                for (int i = 0; i < n; i++)
+                    for (int j = 0; j < n; j++) {
+                        for (int r = 0, k = 0; r < n; r++)
+                            for (int c = 0; c < n; c++)
+                                if (r != i && c != j) minor[k++] = matrix[r*n+c];
+                        REQUIRE(isApproximatelyEqual(gradient[i*n+j], permanent_glynn(minor.data(), n-1), 1e-12));
+                    }
+            }
+            THEN("expansion along a row gives back the permanent") {
+                std::complex<double> p = 0;
+                for (int j = 0; j < n; j++) p += matrix[2*n+j] * gradient[2*n+j];
+                REQUIRE(isApproximatelyEqual(p, permanent_glynn(matrix.data(), n), 1e-12));
+            }
+        }
+        WHEN("computing a double matrix of size 1 and 2") {
+            std::vector<double> matrix = {1, 2, 3, 4};
+            std::vector<double> gradient(4);
+            permanent_gradient(matrix.data(), 1, gradient.data());
+            REQUIRE(gradient[0] == 1);
+            permanent_gradient(matrix.data(), 2, gradient.data());
+            REQUIRE(gradient == std::vector<double>({4, 3, 2, 1}));
+        }
+    }
+    GIVEN("a block structured matrix") {
+        /* blocks {0,3}x{1,4}, {1}x{2}, {2,4,5}x{0,3,5} */
+        std::vector<long long> matrix = {0, 1, 0, 0, 2, 0,
+                                         0, 0, 3, 0, 0, 0,
+                                         1, 0, 0, 2, 0, 3,
+                                         0, 4, 0, 0, 5, 0,
+                                         4, 0, 0, 0, 0, 5,
+                                         6, 0, 0, 7, 0, 8};
+        WHEN("computing with block decomposition") {
+            auto n_threads = GENERATE(1, 4);
+            std::vector<int> component;
+            THEN("blocks are found") {
+                REQUIRE(permanent_components(matrix.data(), 6, component) == 3);
+                REQUIRE(component[0] == component[3]);
+                REQUIRE(component[0] == component[6+1]);
+                REQUIRE(component[2] == component[6+5]);
+                REQUIRE(component[1] != component[0]);
+            }
+            THEN("permanent is the product of the block permanents") {
+                /* (1*5+2*4) * 3 * (1*(0*8+5*7)+2*(4*8+5*6)+3*(4*7+0*6)) */
+                REQUIRE(permanent<long long>(matrix.data(), 6, n_threads == 1 ? 3 : n_threads) == 13 * 3 * 243);
+                std::vector<double> matrix_fl(matrix.begin(), matrix.end());
+                REQUIRE(isApproximatelyEqual(permanent<double>(matrix_fl.data(), 6, n_threads),
+                                             permanent_ryser(matrix_fl.data(), 6, n_threads), 1e-9));
+            }
+            THEN("glynn is still rejected for int") {
+                REQUIRE_THROWS_AS(permanent<long long>(matrix.data(), 6, n_threads, "glynn"), std::invalid_argument);
+            }
+        }
+        WHEN("matrix has an empty row or column, or unbalanced blocks") {
+            std::vector<int> component;
+            std::vector<long long> empty_col = matrix;
+            for (int i = 0; i < 6; i++) empty_col[i * 6 + 2] = 0;
+            REQUIRE(permanent_components(empty_col.data(), 6, component) == 0);
+            REQUIRE(permanent<long long>(empty_col.data(), 6, 3) == 0);
+            std::vector<long long> unbalanced = {1, 0, 0,
+                                                 2, 0, 0,
+                                                 0, 3, 4};
+            REQUIRE(permanent_components(unbalanced.data(), 3, component) == 0);
+            REQUIRE(permanent<long long>(unbalanced.data(), 3, 3) == 0);
+            REQUIRE(permanent_ryser(unbalanced.data(), 3, 3) == 0);
+        }
+    }
+    GIVEN("an empty matrix") {
+        std::vector<long long> matrix(1);
+        std::vector<double> matrix_fl(1);
+        THEN("permanent is 1") {
+            REQUIRE(permanent<long long>(matrix.data(), 0, 3) == 1);
+            REQUIRE(permanent<double>(matrix_fl.data(), 0, 1) == 1);
+            REQUIRE(permanent<double>(matrix_fl.data(), 0, 4, "glynn") == 1);
+        }
+    }
+    GIVEN("a rectangular matrix") {
+        auto k = GENERATE(1, 2, 3, 5);
+        auto n_threads = GENERATE(1, 4);
+        const int n = 7;
+        std::vector<std::complex<double>> matrix(k * n);
+        for (int i = 0; i < k * n; i++)
+            matrix[i] = std::complex<double>(std::cos(i), std::sin(3 * i) / 2);
+        THEN("permanent is the sum of the permanents of the square submatrices") {
+            std::complex<double> expected = 0;
+            std::vector<std::complex<double>> square(k * k);
+            for (int cols = 0; cols < (1 << n); cols++) {
+                std::vector<int> idx;
+                for (int j = 0; j < n; j++) if ((cols >> j) & 1) idx.push_back(j);
+                if (int(idx.size()) != k) continue;
+                for (int i = 0; i < k; i++)
+                    for (int j = 0; j < k; j++)
+                        square[i * k + j] = matrix[i * n + idx[j]];
+                expected += permanent_glynn(square.data(), k);
+            }
+            REQUIRE(isApproximatelyEqual(permanent_rect(matrix.data(), k, n, n_threads), expected, 1e-10));
+            std::vector<std::complex<double>> transposed(k * n);
+            for (int i = 0; i < k; i++)
+                for (int j = 0; j < n; j++)
+                    transposed[j * k + i] = matrix[i * n + j];
+            REQUIRE(isApproximatelyEqual(permanent_rect(transposed.data(), n, k, n_threads), expected, 1e-10));
+        }
+        THEN("all ones matrix gives the number of injections") {
+            std::vector<long long> ones(k * n, 1);
+            long long injections = 1;
+            for (int i = 0; i < k; i++) injections *= n - i;
+            REQUIRE(permanent_rect(ones.data(), k, n, n_threads) == injections);
+        }
+        THEN("glynn is rejected") {
+            REQUIRE_THROWS_AS(permanent_rect(matrix.data(), k, n, n_threads, "glynn"), std::invalid_argument);
+        }
+    }
+}
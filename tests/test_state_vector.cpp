@@ -0,0 +1,82 @@
+// MIT License
+//
+// Copyright (c) 2022 Quandela
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <catch2/catch.hpp>
+#include "../src/state_vector.h"
+
+SCENARIO("Testing state vectors") {
+    SECTION("adding components") {
+        state_vector sv(fockstate("|1,0>"), 0.5);
+        sv.add(fockstate("|0,1>"), std::complex<double>(0, 0.5));
+        sv.add(fockstate("|1,0>"), 0.5);
+        REQUIRE(sv.size() == 2);
+        REQUIRE(sv.get(fockstate("|1,0>")) == std::complex<double>(1));
+        REQUIRE(sv.get(fockstate("|0,1>")) == std::complex<double>(0, 0.5));
+        REQUIRE(sv.get(fockstate("|2,0>")) == std::complex<double>(0));
+        REQUIRE(!sv.contains(fockstate("|{P:H},0>")));
+        sv.add(fockstate("|{P:H},0>"), 1);
+        REQUIRE(sv.size() == 3);
+        REQUIRE(sv.begin()->first == fockstate("|1,0>"));
+        REQUIRE(sv.norm() == Approx(1.5));
+        sv.normalize();
+        REQUIRE(sv.norm() == Approx(1));
+        REQUIRE_THROWS_AS(state_vector().normalize(), std::invalid_argument);
+    }
+    SECTION("large vectors and pruning") {
+        fs_array fsa(6, 4);
+        state_vector sv;
+        for(auto fs: fsa)
+            sv.add(fs, double(fs.rank()));
+        REQUIRE(sv.size() == fsa.count());
+        for(unsigned long long i = 0; i < fsa.count(); i++)
+            REQUIRE(sv.get(fsa[i]) == std::complex<double>(double(i)));
+        sv.prune(10);
+        REQUIRE(sv.size() == fsa.count()-11);
+        REQUIRE(!sv.contains(fsa[10]));
+        REQUIRE(sv.get(fsa[11]) == std::complex<double>(11));
+        std::vector<std::complex<double>> coefs(fsa.count());
+        sv.to_dense(fsa, coefs.data());
+        REQUIRE(coefs[5] == std::complex<double>(0));
+        REQUIRE(coefs[12] == std::complex<double>(12));
+        state_vector back = state_vector::from_dense(fsa, coefs.data());
+        REQUIRE(back.size() == sv.size());
+        REQUIRE(back.inner(sv).real() == Approx(sv.norm() * sv.norm()));
+        REQUIRE_THROWS_AS(state_vector(fockstate("|1,1>")).to_dense(fsa, coefs.data()), std::invalid_argument);
+        REQUIRE_THROWS_AS(state_vector(fockstate("|{_:0},1,0,0,0,2>")).to_dense(fsa, coefs.data()),
+                          std::invalid_argument);
+    }
+    SECTION("inner and tensor products") {
+        state_vector a(fockstate("|1,0>"), std::complex<double>(0, 1));
+        a.add(fockstate("|0,1>"), 1);
+        state_vector b(fockstate("|1,0>"), 2);
+        REQUIRE(a.inner(b) == std::complex<double>(0, -2));
+        REQUIRE(b.inner(a) == std::complex<double>(0, 2));
+        state_vector c = a * b;
+        REQUIRE(c.size() == 2);
+        REQUIRE(c.get(fockstate("|1,0,1,0>")) == std::complex<double>(0, 2));
+        REQUIRE(c.get(fockstate("|0,1,1,0>")) == std::complex<double>(2));
+        state_vector d = a + b;
+        REQUIRE(d.get(fockstate("|1,0>")) == std::complex<double>(2, 1));
+        d.scale(2);
+        REQUIRE(d.get(fockstate("|0,1>")) == std::complex<double>(2));
+    }
+}
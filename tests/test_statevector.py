@@ -0,0 +1,57 @@
+# -*- coding: utf-8 -*-
+# MIT License
+#
+# Copyright (c) 2022 Quandela
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import pytest
+import numpy as np
+import quandelibc as qc
+
+
+def test_state_vector_basic():
+    sv = qc.StateVector(qc.FockState([1, 0]), 1j)
+    sv.add(qc.FockState([0, 1]), 1)
+    assert len(sv) == 2
+    assert sv[qc.FockState([1, 0])] == 1j
+    assert qc.FockState([0, 1]) in sv
+    assert dict(sv) == {qc.FockState([1, 0]): 1j, qc.FockState([0, 1]): 1}
+    assert sv.norm() == pytest.approx(2 ** 0.5)
+    sv.normalize()
+    assert sv.inner(sv) == pytest.approx(1)
+
+
+def test_state_vector_products():
+    a = qc.StateVector(qc.FockState([1, 0]))
+    b = qc.StateVector(qc.FockState([0, 1]), 2)
+    c = a * b
+    assert c[qc.FockState([1, 0, 0, 1])] == 2
+    assert (a + b).inner(b) == 4
+
+
+def test_state_vector_dense():
+    fsa = qc.FSArray(3, 2)
+    coefs = np.arange(fsa.count(), dtype=complex)
+    sv = qc.StateVector.from_dense(fsa, coefs)
+    assert len(sv) == fsa.count() - 1
+    assert sv[fsa[3]] == 3
+    assert (sv.to_dense(fsa) == coefs).all()
+    with pytest.raises(ValueError):
+        qc.StateVector(qc.FockState("|{_:0},1,0>")).to_dense(fsa)
@@ -0,0 +1,96 @@
+// MIT License
+//
+// Copyright (c) 2022 Quandela
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <complex>
+#include <vector>
+#include <catch2/catch.hpp>
+#include "../src/torontonian.h"
+
+/* reference torontonian from the determinants of all the submatrices */
+static double torontonian_bruteforce(const std::vector<std::complex<double>> &O, int n) {
+    double sum = 0;
+    for (int z = 0; z < (1 << n); z++) {
+        std::vector<int> idx;
+        for (int i = 0; i < n; i++) if ((z >> i) & 1) idx.push_back(i);
+        for (int i = 0; i < n; i++) if ((z >> i) & 1) idx.push_back(i + n);
+        int d = int(idx.size());
+        std::vector<std::complex<double>> P(d * d);
+        for (int a = 0; a < d; a++)
+            for (int b = 0; b < d; b++)
+                P[a * d + b] = (a == b ? 1. : 0.) - O[idx[a] * 2 * n + idx[b]];
+        std::complex<double> det = 1;
+        for (int c = 0; c < d; c++) {
+            int pivot = c;
+            for (int r = c + 1; r < d; r++) if (std::abs(P[r * d + c]) > std::abs(P[pivot * d + c])) pivot = r;
+            if (pivot != c) {
+                for (int k = 0; k < d; k++) std::swap(P[pivot * d + k], P[c * d + k]);
+                det = -det;
+            }
+            det *= P[c * d + c];
+            for (int r = c + 1; r < d; r++) {
+                auto y = P[r * d + c] / P[c * d + c];
+                for (int k = c; k < d; k++) P[r * d + k] -= y * P[c * d + k];
+            }
+        }
+        sum += ((n - int(idx.size()) / 2) % 2 ? -1 : 1) / std::sqrt(det.real());
+    }
+    return sum;
+}
+
+SCENARIO("C++ Testing Torontonian") {
+    GIVEN("the vacuum") {
+        std::vector<double> O(36);
+        REQUIRE(std::abs(torontonian(O.data(), 3, 2)) < 1e-12);
+    }
+    GIVEN("a product of single mode states") {
+        /* tor is the product of 1/sqrt(det(I-O_i))-1 */
+        const int n = 3;
+        std::vector<double> O(4 * n * n);
+        double expected = 1;
+        for (int i = 0; i < n; i++) {
+            double a = 0.1 * (i + 1), b = 0.05 * i;
+            O[i * 2 * n + i] = O[(i + n) * 2 * n + i + n] = a;
+            O[i * 2 * n + i + n] = O[(i + n) * 2 * n + i] = b;
+            expected *= 1 / std::sqrt((1 - a) * (1 - a) - b * b) - 1;
+        }
+        auto n_threads = GENERATE(1, 3);
+        REQUIRE(std::abs(torontonian(O.data(), n, n_threads) - expected) < 1e-12);
+    }
+    GIVEN("a hermitian matrix") {
+        auto n = GENERATE(1, 4, 6);
+        auto n_threads = GENERATE(1, 2, 5);
+        std::vector<std::complex<double>> O(4 * n * n);
+        for (int i = 0; i < 2 * n; i++)
+            for (int j = i; j < 2 * n; j++) {
+                O[i * 2 * n + j] = std::complex<double>(std::cos(i + 2 * j), i == j ? 0 : std::sin(i * j + 1)) / (4. * n);
+                O[j * 2 * n + i] = std::conj(O[i * 2 * n + j]);
+            }
+        auto expected = torontonian_bruteforce(O, n);
+        auto tor = torontonian(O.data(), n, n_threads);
+        REQUIRE(std::abs(tor - expected) < 1e-10 * (1 + std::abs(expected)));
+        REQUIRE(tor.imag() == 0);
+    }
+    GIVEN("a non positive definite matrix") {
+        std::vector<double> O = {2, 0, 0, 2};
+        REQUIRE_THROWS_AS(torontonian(O.data(), 1, 1), std::invalid_argument);
+    }
+}